@@ -4,22 +4,25 @@
 // Includes mainly for class Database
 #include <stdexcept>
 #include <iostream>
-#ifndef MMF
 #include <fstream>
-#else
+#include <cstdio>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef MMF
 // Includes especially for memory mapped files
 #include <unistd.h>
 #include <sys/mman.h>
-#include <cstdio>
 #include <cstdlib>
-#include <sys/types.h>
-#include <sys/stat.h>
 #include <fcntl.h>
+#if defined(__SSE2__)
+// Includes for the newline scan of the row index
+#include <immintrin.h>
+#endif
 #endif
 #include <type_traits>
-
-// Includes mainly for class Entry
-#include <sstream>
+#include <vector>
+#include <limits>
 
 // Includes mainly for class KDD
 #include <omp.h>
@@ -27,8 +30,17 @@
 #include <algorithm>
 #include <map>
 #include <list>
+#include <tuple>
 
+#ifdef TUNED_TRAITS
+// Node sizes and search of the trees, and the block size of the frozen
+// indexes, picked by 'make autotune' on this host
+#include "btree_tuned.h"
+#endif
 #include "btree_multimap.h"
+#include "btree_posting.h"
+#include "btree_frozen.h"
+#include "btree_pool.h"
 
 // Definitions for field parsing
 #define NEWLINE 			'\n'
@@ -41,17 +53,68 @@
 #endif
 
 // Performance parameters
-#define SLOTS 				128
+#ifndef TUNED_TRAITS
+#define INNER_SLOTS			128
+#define LEAF_SLOTS			128
 //#define BIN_THRESHOLD 		256*1024*1024
-#define BIN_THRESHOLD 		1024
+#define BIN_THRESHOLD 		256
+#else
+#define INNER_SLOTS			TUNED_INNER_SLOTS
+#define LEAF_SLOTS			TUNED_LEAF_SLOTS
+#define BIN_THRESHOLD		TUNED_BIN_THRESHOLD
+#endif
+// Build the indexes by sorting the parsed lists and bulk loading the trees
+#define BULK_LOAD
+// Allocate the tree nodes from slabs instead of one by one
+#define NODE_POOL
+// Keep the values of every user and ad as one compressed posting list instead
+// of a tree slot per line
+#define POSTING_LIST
+// Keep all the fields in columns, the indexes then refer to row ids instead of
+// offsets in the data file
+//#define COLUMNAR
+// Refer to the lines by 32-bit row ids instead of offsets in the data file,
+// the ids are resolved through the starts of the lines found by one scan
+#define ROW_INDEX
+// Pack the trees of the indexes into read-only arrays once they are built,
+// searched by implicit addressing instead of following node pointers
+#define FROZEN
+// Keep the click and impression sums of every tuple queried by get()
+#define GET_INDEX
+// Keep the click-through rate sums of every user of an ad, ordered by the rate
+#define PROFIT_INDEX
+// Rows of a query are decoded by several threads from this count on
+#define PARALLEL_DECODE		1024
+// Keep a snapshot of the indexes next to the data file, reused on restart
+#define INDEX_SNAPSHOT
+#define SNAPSHOT_SUFFIX		".idx"
+#define SNAPSHOT_VERSION	6
+// Start of the header and of every image in the snapshot is aligned to this
+#define SNAPSHOT_ALIGNMENT	64
+#ifndef MMF
+// The snapshot is mapped into memory just like the data file, and the columns
+// and sums are decoded from the mapped data file
+#undef INDEX_SNAPSHOT
+#undef COLUMNAR
+#undef GET_INDEX
+#undef PROFIT_INDEX
+#undef POSTING_LIST
+#undef ROW_INDEX
+#endif
+#ifndef BULK_LOAD
+// Posting lists are only built from the sorted lists
+#undef POSTING_LIST
+#endif
 
 namespace dsa
 {	
 	typedef unsigned int TKey;
-	#ifndef MMF
+	#if !defined(MMF)
 	typedef std::streamoff TData;
-	#else
+	#elif !defined(ROW_INDEX)
 	typedef size_t TData;
+	#else
+	typedef unsigned int TData;
 	#endif
 
 	// Trait setup for the map
@@ -61,14 +124,14 @@ namespace dsa
 	    static const bool   selfverify = false;
 	    static const bool   debug = false;
 
-	    static const int    leafslots = _innerSlots;
-	    static const int    innerslots = _leafSlots;
+	    static const int    leafslots = _leafSlots;
+	    static const int    innerslots = _innerSlots;
 
 	    static const size_t binsearch_threshold = BIN_THRESHOLD;
 	};
 	typedef stx::btree_multimap<TKey, TData, 
 								std::less<TKey>, 
-								struct btree_traits_speed<SLOTS, SLOTS> > BpTreeMap;
+								struct btree_traits_speed<INNER_SLOTS, LEAF_SLOTS> > BpTreeMap;
 
 	// TSV field definitions
 	enum field 
@@ -86,7 +149,7 @@ namespace dsa
 	private:
 		int fd = -1;
 		char* data = NULL;
-		size_t file_size;
+		size_t file_size = 0;
 
 		// Offset in the memory mapped file
 		size_t off;
@@ -109,14 +172,12 @@ namespace dsa
 
 		~MemoryMappedFile()
 		{
-			if(munmap(data, file_size) == -1)
-		        throw "main(): Fail to un-mapping the file.";
-		    close(fd);
+			close();
 		}
 
 		void open(const std::string& file_path)
 		{
-			fd = fileno(fopen(file_path.c_str(), "r"));
+			fd = ::open(file_path.c_str(), O_RDONLY);
         	if(fd < 0)
         		throw std::runtime_error("MMF(): Fail to open the file.");
 
@@ -128,13 +189,35 @@ namespace dsa
         	// Map the file into memory
         	data = reinterpret_cast<char*>(mmap((caddr_t)0, file_size, PROT_READ, MAP_PRIVATE, fd, 0));
 			if(data == MAP_FAILED)
+			{
+				data = NULL;
 				throw std::runtime_error("MMF(): Fail to map the file into memory.");
+			}
 			#ifdef DEBUG
 			else
 				std::cout << "File mapped." << std::endl;
 			#endif
 		}
 
+		// Unmap the file and close it, it may be opened again afterwards.
+		void close()
+		{
+			// Nothing sensible can be done if un-mapping fails here.
+			if(is_open())
+				munmap(data, file_size);
+			if(fd >= 0)
+				::close(fd);
+			fd = -1;
+			data = NULL;
+			file_size = 0;
+			off = 0;
+		}
+
+		bool is_open() const
+		{
+			return (data != NULL);
+		}
+
 	public:
 		// Stream support functions
 		bool eof() const
@@ -162,6 +245,42 @@ namespace dsa
 			return data + off;
 		}
 
+		// Raw access to the whole mapping
+		const char* begin() const
+		{
+			return data;
+		}
+
+		const char* end() const
+		{
+			return data + file_size;
+		}
+
+		size_t size() const
+		{
+			return file_size;
+		}
+
+		// End of the line at the current offset, the line is left in place
+		const char* getline_end() const
+		{
+			return line_end(off);
+		}
+
+		// Stateless access to the line at pos. Unlike the stream functions
+		// above these don't touch the offset, so several threads can read
+		// lines at once.
+		const char* line_at(TData pos) const
+		{
+			return data + pos;
+		}
+
+		const char* line_end(TData pos) const
+		{
+			const char* eol = reinterpret_cast<const char*>(memchr(data + pos, NEWLINE, file_size - pos));
+			return (eol == NULL) ? end() : eol;
+		}
+
 		std::string getline()
 		{
 			size_t length = 0;
@@ -171,191 +290,254 @@ namespace dsa
 	};
 	#endif
 
-	class Database
+	#if defined(ROW_INDEX) && !defined(COLUMNAR)
+	// Starts of the non-blank lines of the data file, a row id is the position
+	// of its line in here. The mapping is scanned along with the indexes by
+	// several threads, 32 or 16 bytes per compare where AVX2 or SSE2 is
+	// available, and the starts are kept in the snapshot.
+	class RowIndex
 	{
 	private:
-        #ifndef MMF
-        std::ifstream stream;
-        #else
-        MemoryMappedFile mmf;
-        #endif
-        BpTreeMap map, ad_id_map;
-        stx::btree_multimap<TKey, TKey, 
-							std::less<TKey>, 
-							struct btree_traits_speed<SLOTS, SLOTS> > user_id_ad_id_map;
+		const char* head = NULL;
+		const char* tail = NULL;
+		// Starts are either owned or a view of the mapped snapshot
+		std::vector<size_t> starts;
+		const size_t* view = NULL;
+		size_t count = 0;
 
-	public:
-		Database(const std::string& file_path)
+	private:
+		// Keep the line at ptr unless it is blank or past the end
+		static void push_line(const char* head, const char* ptr, const char* tail, std::vector<size_t>& out)
 		{
-			#ifndef MMF
-			stream.open(file_path, std::ifstream::in);
-			if(!stream.is_open())
-				throw std::runtime_error("Database(): Fail to open file.");
-			#else
-			mmf.open(file_path);
-			#endif
-			construct_tree();
+			if(ptr < tail && *ptr != NEWLINE)
+				out.push_back(ptr - head);
 		}
 
-		~Database()
+		// Keep the lines following the newlines in [begin, end)
+		static void scan(const char* head, const char* begin, const char* end, const char* tail,
+						 std::vector<size_t>& out)
 		{
+			const char* ptr = begin;
+
+			#if defined(__AVX2__)
+			const __m256i newline32 = _mm256_set1_epi8(NEWLINE);
+			for(; ptr + 32 <= end; ptr += 32)
+			{
+				__m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr));
+				unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newline32));
+				for(; mask != 0; mask &= mask - 1)
+					push_line(head, ptr + __builtin_ctz(mask) + 1, tail, out);
+			}
+			#endif
+
+			#if defined(__SSE2__)
+			const __m128i newline16 = _mm_set1_epi8(NEWLINE);
+			for(; ptr + 16 <= end; ptr += 16)
+			{
+				__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+				unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newline16));
+				for(; mask != 0; mask &= mask - 1)
+					push_line(head, ptr + __builtin_ctz(mask) + 1, tail, out);
+			}
+			#endif
+
+			for(; ptr < end; ptr++)
+			{
+				if(*ptr == NEWLINE)
+					push_line(head, ptr + 1, tail, out);
+			}
 		}
 
-		#ifndef MMF
-		std::ifstream& get_stream()
+	public:
+		// Resolve the rows in the mapped data file, the starts are built or
+		// attached afterwards.
+		void bind(const MemoryMappedFile& mmf)
 		{
-			return stream;
+			head = mmf.begin();
+			tail = mmf.end();
 		}
-		#endif
 
-		void construct_tree()
+		void build()
 		{
+			// Chunks are split anywhere, a line belongs to the chunk holding
+			// the newline in front of it.
+			int num_chunks = omp_get_max_threads();
+			std::vector<std::vector<size_t> > chunks(num_chunks);
+			#pragma omp parallel for schedule(static, 1)
+			for(int idx = 0; idx < num_chunks; idx++)
+			{
+				const char* begin = head + (tail - head) / num_chunks * idx;
+				const char* end = (idx == num_chunks - 1) ? tail : head + (tail - head) / num_chunks * (idx + 1);
+				if(idx == 0)
+					push_line(head, head, tail, chunks[idx]);
+				scan(head, begin, end, tail, chunks[idx]);
+			}
 
-			#ifdef DEBUG
-			std::cout << "Start constructing tree..." << std::endl;
-			// Counter for cycles
-			int counter = 0;
-			#endif
+			std::vector<size_t> offsets(num_chunks + 1, 0);
+			for(int idx = 0; idx < num_chunks; idx++)
+				offsets[idx + 1] = offsets[idx] + chunks[idx].size();
+			if(offsets.back() > (size_t)std::numeric_limits<TData>::max())
+				throw std::runtime_error("RowIndex(): Too many lines for the row ids.");
 
-			TData currentPos = 0;
-			//#pragma omp parallel 
-			//{
-			//#pragma omp single
-			//{
-			#ifndef MMF
-			std::string new_line;
-			while(!stream.eof())
-			#else
-			while(!mmf.eof())
-			#endif
+			starts.resize(offsets.back());
+			#pragma omp parallel for
+			for(int idx = 0; idx < num_chunks; idx++)
 			{
-				// Get the position of current line
-				#ifndef MMF
-				currentPos = stream.tellg();
-				std::getline(stream, new_line);
-				#else
-				//std::cout << "Getting current fpos..." << std::endl;
-				currentPos = mmf.tellg();
-				//std::cout << "Current fpos: " << currentPos << std::endl;
-				#endif
+				std::copy(chunks[idx].begin(), chunks[idx].end(), starts.begin() + offsets[idx]);
+				std::vector<size_t>().swap(chunks[idx]);
+			}
+			view = starts.data();
+			count = starts.size();
 
-				#ifndef MMF
-				// Skip blank line
-				if(new_line.length() == 0)
-					continue;
+			#ifdef DEBUG
+			std::cout << "Row index: " << count << " lines." << std::endl;
+			#endif
+		}
 
-				map.insert(std::make_pair(parse_field<TKey, USER_ID>(new_line, DELIM), currentPos));
-				#else
+		size_t size() const
+		{
+			return count;
+		}
 
-				auto user = parse_field<TKey, USER_ID>(mmf, DELIM);
-				mmf.seekg(currentPos);
-				auto ad = parse_field<TKey, AD_ID>(mmf, DELIM);
-				//#pragma omp parallel
-				//{
-				//#pragma omp single nowait
-				//{
-					//#pragma omp task
-					map.insert(std::make_pair(user, currentPos));
-					//#pragma omp task
-					ad_id_map.insert(std::make_pair(ad, currentPos));
-					//#pragma omp task
-					user_id_ad_id_map.insert(std::make_pair(user, ad));
-				//}
-				//#pragma omp taskwait
-				//}
+		#ifdef INDEX_SNAPSHOT
+		// View the starts written by dump_image() at data. Returns the size of
+		// the image, or 0 if it doesn't fit the data file.
+		size_t attach(const char* data, size_t size)
+		{
+			unsigned long long lines;
+			if(size < sizeof(lines))
+				return 0;
+			memcpy(&lines, data, sizeof(lines));
+			if(lines > (size - sizeof(lines)) / sizeof(size_t))
+				return 0;
 
-				#endif
+			const size_t* first = reinterpret_cast<const size_t*>(data + sizeof(lines));
+			if(lines > 0 && first[lines - 1] >= (size_t)(tail - head))
+				return 0;
 
-				#ifdef DEBUG
-				counter++;
-				if((counter % NOTICE_PER_LINE) == 0)
-					std::cout << "Item " << counter << " inserted." << std::endl;
-				#ifdef PAUSE_AT_RATIO
-				if((counter / NOTICE_PER_LINE) == PAUSE_AT_RATIO)
-					break;
-				#endif
-				#endif
-			}
-			//}
-			//}
-			#ifdef DEBUG
-			std::cout << "... Complete!" << std::endl;
-			#endif
+			std::vector<size_t>().swap(starts);
+			view = first;
+			count = lines;
+			return sizeof(lines) + lines * sizeof(size_t);
 		}
 
-		template <typename FieldType, enum field Field>
-		#ifndef MMF
-		FieldType parse_field(std::string &str, const char& delim)
-		#else
-		FieldType parse_field(MemoryMappedFile& mmf, const char& delim)
-		#endif		
+		void detach()
 		{
-			static_assert(std::is_same<FieldType, unsigned char>::value ||
-						  std::is_same<FieldType, unsigned short>::value ||
-						  std::is_same<FieldType, unsigned int>::value || 
-						  std::is_same<FieldType, unsigned long long>::value,
-						  "parse_field(): Designated template type isn't acceptable.");
+			view = starts.data();
+			count = starts.size();
+		}
 
-			FieldType result = 0;
-			#ifndef MMF
-			int ptr = 0;
-			#else
-			char c = mmf.getc();
-			#endif
+		// Write the number of lines followed by their starts.
+		void dump_image(std::ostream& os) const
+		{
+			unsigned long long lines = count;
+			os.write(reinterpret_cast<const char*>(&lines), sizeof(lines));
+			os.write(reinterpret_cast<const char*>(view), count * sizeof(size_t));
+		}
+		#endif
 
-			#ifndef MMF
-			// Shift to desired field according to deliminator.
-			for(int idx = 0; idx < Field; ptr++)
-			{
-				if(str[ptr] == delim)
-					idx++;
-				if(str[ptr] == NEWLINE)
-					throw std::runtime_error("parse_field(): Field out of range.");
-			}
-			#else
-			for(int idx = 0; idx < Field; c = mmf.getc())
-			{	
-				//std::cout << "c=" << c << ", idx=" << idx << std::endl;
-				if(c == delim)
-					idx++;
-				if(c == NEWLINE)
-					throw std::runtime_error("parse_field(): Field out of range.");
-			}
-			//std::cout << std::endl;
-			#endif
+		// Id of the first line starting at ptr or behind it
+		TData first_row(const char* ptr) const
+		{
+			return std::lower_bound(view, view + count, (size_t)(ptr - head)) - view;
+		}
 
-			// Start extracting the number.
-			// Stop when: deliminator, newline character, end-of-string, is found.
-			#ifndef MMF
-			for(; str[ptr] != delim && 
-				  str[ptr] != NEWLINE && 
-				  str[ptr] != '\0'; ptr++)
-			{
-				result *= 10;
-				result += str[ptr] - '0';
-			}
-			#else
-			for(; c != delim && 
-				  c != NEWLINE && 
-				  c != '\0'; c = mmf.getc())
-			{
-				result *= 10;
-				result += c - '0';
-			}
+		const char* line_at(TData row) const
+		{
+			return head + view[row];
+		}
 
-			// Fast forward to end of the string
-			for( ; c != NEWLINE; c = mmf.getc());
+		// The line ends in front of the newlines before the next line, or at
+		// the end of the file if it isn't terminated.
+		const char* line_end(TData row) const
+		{
+			const char* eol = (row + 1 < count) ? head + view[row + 1] : tail;
+			while(eol[-1] == NEWLINE)
+				eol--;
+			return eol;
+		}
+	};
+	#endif
+
+	#ifdef INDEX_SNAPSHOT
+	// Header of the index snapshot, the snapshot is only valid for the data
+	// file of the very same size and modification time.
+	struct SnapshotHeader
+	{
+		char signature[8];
+		unsigned int version;
+		unsigned int features;
+		unsigned long long file_size;
+		long long mtime_sec;
+		long long mtime_nsec;
+
+		void fill(const struct stat& st)
+		{
+			memset(this, 0, sizeof(*this));
+			memcpy(signature, "kdd-idx", sizeof(signature));
+			version = SNAPSHOT_VERSION;
+			#ifdef COLUMNAR
+			features |= 1;
+			#endif
+			#ifdef GET_INDEX
+			features |= 2;
 			#endif
+			#ifdef PROFIT_INDEX
+			features |= 4;
+			#endif
+			#ifdef POSTING_LIST
+			features |= 8;
+			#endif
+			#ifdef ROW_INDEX
+			features |= 16;
+			#endif
+			#ifdef FROZEN
+			features |= 32;
+			#endif
+			#if defined(ROW_INDEX) && !defined(COLUMNAR)
+			features |= 64;
+			#endif
+			file_size = st.st_size;
+			mtime_sec = st.st_mtim.tv_sec;
+			mtime_nsec = st.st_mtim.tv_nsec;
+		}
 
-			return result;
+		bool same(const SnapshotHeader& other) const
+		{
+			return (memcmp(signature, other.signature, sizeof(signature)) == 0) &&
+				   (version == other.version) &&
+				   (features == other.features) &&
+				   (file_size == other.file_size) &&
+				   (mtime_sec == other.mtime_sec) &&
+				   (mtime_nsec == other.mtime_nsec);
 		}
 
-		// Friend classes
-		friend class KDD;
+		// Round an offset in the snapshot up to the alignment
+		static size_t align(size_t off)
+		{
+			return (off + SNAPSHOT_ALIGNMENT - 1) / SNAPSHOT_ALIGNMENT * SNAPSHOT_ALIGNMENT;
+		}
+
+		// Pad the snapshot with zeros up to the next aligned offset.
+		static void pad(std::ostream& os)
+		{
+			size_t off = os.tellp();
+			for(size_t end = align(off); off < end; off++)
+				os.put(0);
+		}
 	};
+	#endif
+
+	#ifdef COLUMNAR
+	class Columns;
+	#endif
 
 	class Entry
 	{
+	#ifdef COLUMNAR
+	friend class Columns;
+	#endif
+
 	private:
 		unsigned short click;
 		unsigned int impression;
@@ -394,6 +576,17 @@ namespace dsa
 			return query_id;
 		}
 
+		// getters for the get index
+		unsigned char get_position() const
+		{
+			return position;
+		}
+
+		unsigned char get_depth() const
+		{
+			return depth;
+		}
+
 		// getters for impression()
 		unsigned long long get_display_url() const
 		{
@@ -405,66 +598,1226 @@ namespace dsa
 			return advertiser_id;
 		}
 
-		unsigned int get_keyword_id() const
-		{
-			return keyword_id;
+		unsigned int get_keyword_id() const
+		{
+			return keyword_id;
+		}
+
+		unsigned int get_title_id() const
+		{
+			return title_id;
+		}
+
+		unsigned int get_description_id() const
+		{
+			return description_id;
+		}
+
+		unsigned int get_user_id() const
+		{
+			return user_id;
+		}
+
+	public:
+		Entry()
+		{
+		}
+
+		Entry(const std::string& entry)
+			: Entry(entry.data(), entry.data() + entry.size())
+		{
+		}
+
+		// Decode the line [ptr, eol) in place, all the fields are extracted in
+		// a single pass without copying the line.
+		Entry(const char* ptr, const char* eol)
+		{
+			click = next_field<unsigned short>(ptr, eol);
+			impression = next_field<unsigned int>(ptr, eol);
+			display_url = next_field<unsigned long long>(ptr, eol);
+			ad_id = next_field<unsigned int>(ptr, eol);
+			advertiser_id = next_field<unsigned short>(ptr, eol);
+			depth = next_field<unsigned char>(ptr, eol);
+			position = next_field<unsigned char>(ptr, eol);
+			query_id = next_field<unsigned int>(ptr, eol);
+			keyword_id = next_field<unsigned int>(ptr, eol);
+			title_id = next_field<unsigned int>(ptr, eol);
+			description_id = next_field<unsigned int>(ptr, eol);
+			user_id = next_field<unsigned int>(ptr, eol);
+		}
+
+	private:
+		// Extract the number at ptr and move ptr behind its delimiter. The
+		// digit test stops at the delimiter, so no separate scan is needed.
+		template <typename FieldType>
+		static FieldType next_field(const char*& ptr, const char* eol)
+		{
+			if(ptr == eol)
+				throw std::runtime_error("Entry(): Field out of range.");
+
+			FieldType result = 0;
+			for(unsigned int digit; ptr != eol && (digit = *ptr - '0') < 10; ptr++)
+				result = result * 10 + digit;
+
+			// Skip the delimiter
+			if(ptr != eol)
+				ptr++;
+
+			return result;
+		}
+
+	public:
+		// Functions for filtering
+		bool isGet(unsigned int _user_id,
+				   unsigned int _ad_id,
+				   unsigned int _query_id,
+				   unsigned short _position,
+				   unsigned short _depth) const
+		{
+			return (_user_id == user_id) &&
+				   (_ad_id == ad_id) &&
+				   (_query_id == query_id) &&
+				   (_position == position) &&
+				   (_depth == depth);
+		}
+
+		bool hasClicked() const
+		{
+			return click > 0;
+		}
+
+		bool hasImpression() const
+		{
+			return impression > 0;
+		}
+	};
+
+	#ifdef COLUMNAR
+	// Column of a field, either owned or a view of the mapped snapshot.
+	template <typename T>
+	class Column
+	{
+	private:
+		std::vector<T> values;
+		const T* view = NULL;
+		size_t count = 0;
+
+	public:
+		const T& operator[](size_t row) const
+		{
+			return view[row];
+		}
+
+		size_t size() const
+		{
+			return count;
+		}
+
+		// Own n values, they are filled by set().
+		void resize(size_t n)
+		{
+			values.resize(n);
+			view = values.data();
+			count = n;
+		}
+
+		void set(size_t row, const T& value)
+		{
+			values[row] = value;
+		}
+
+		#ifdef INDEX_SNAPSHOT
+		void dump(std::ostream& os) const
+		{
+			SnapshotHeader::pad(os);
+			os.write(reinterpret_cast<const char*>(view), count * sizeof(T));
+		}
+
+		// View n values at off in the snapshot and move off behind them.
+		bool attach(const char* base, size_t size, size_t& off, size_t n)
+		{
+			off = SnapshotHeader::align(off);
+			if(off + n * sizeof(T) > size)
+				return false;
+
+			std::vector<T>().swap(values);
+			view = reinterpret_cast<const T*>(base + off);
+			count = n;
+			off += n * sizeof(T);
+			return true;
+		}
+
+		void detach()
+		{
+			view = values.data();
+			count = values.size();
+		}
+		#endif
+	};
+
+	// All the fields of the data file, one column per field and one row per
+	// line. Filters scan the few columns they need instead of decoding lines.
+	class Columns
+	{
+	private:
+		Column<unsigned short> click;
+		Column<unsigned int> impression;
+		Column<unsigned long long> display_url;
+		Column<unsigned int> ad_id;
+		Column<unsigned short> advertiser_id;
+		Column<unsigned char> depth;
+		Column<unsigned char> position;
+		Column<unsigned int> query_id;
+		Column<unsigned int> keyword_id;
+		Column<unsigned int> title_id;
+		Column<unsigned int> description_id;
+		Column<unsigned int> user_id;
+
+	public:
+		size_t size() const
+		{
+			return user_id.size();
+		}
+
+		// Join the rows decoded from each chunk into the columns, the chunks
+		// are released on the way.
+		void assign(std::vector<std::vector<Entry> >& chunks)
+		{
+			std::vector<size_t> offsets(chunks.size() + 1, 0);
+			for(size_t idx = 0; idx < chunks.size(); idx++)
+				offsets[idx + 1] = offsets[idx] + chunks[idx].size();
+
+			resize(offsets.back());
+
+			#pragma omp parallel for
+			for(int idx = 0; idx < (int)chunks.size(); idx++)
+			{
+				for(size_t row = offsets[idx]; row < offsets[idx + 1]; row++)
+					set(row, chunks[idx][row - offsets[idx]]);
+				std::vector<Entry>().swap(chunks[idx]);
+			}
+		}
+
+		// Materialize the row as an Entry
+		Entry row(size_t row) const
+		{
+			Entry entry;
+			entry.click = click[row];
+			entry.impression = impression[row];
+			entry.display_url = display_url[row];
+			entry.ad_id = ad_id[row];
+			entry.advertiser_id = advertiser_id[row];
+			entry.depth = depth[row];
+			entry.position = position[row];
+			entry.query_id = query_id[row];
+			entry.keyword_id = keyword_id[row];
+			entry.title_id = title_id[row];
+			entry.description_id = description_id[row];
+			entry.user_id = user_id[row];
+			return entry;
+		}
+
+		#ifdef INDEX_SNAPSHOT
+		// Write the number of rows followed by the columns, each of them
+		// aligned in the snapshot.
+		void dump(std::ostream& os) const
+		{
+			unsigned long long rows = size();
+			os.write(reinterpret_cast<const char*>(&rows), sizeof(rows));
+
+			click.dump(os);
+			impression.dump(os);
+			display_url.dump(os);
+			ad_id.dump(os);
+			advertiser_id.dump(os);
+			depth.dump(os);
+			position.dump(os);
+			query_id.dump(os);
+			keyword_id.dump(os);
+			title_id.dump(os);
+			description_id.dump(os);
+			user_id.dump(os);
+		}
+
+		// View the columns written by dump() at off in the snapshot.
+		bool attach(const char* base, size_t size, size_t& off)
+		{
+			unsigned long long rows;
+			if(off + sizeof(rows) > size)
+				return false;
+			memcpy(&rows, base + off, sizeof(rows));
+			off += sizeof(rows);
+
+			return click.attach(base, size, off, rows) &&
+				   impression.attach(base, size, off, rows) &&
+				   display_url.attach(base, size, off, rows) &&
+				   ad_id.attach(base, size, off, rows) &&
+				   advertiser_id.attach(base, size, off, rows) &&
+				   depth.attach(base, size, off, rows) &&
+				   position.attach(base, size, off, rows) &&
+				   query_id.attach(base, size, off, rows) &&
+				   keyword_id.attach(base, size, off, rows) &&
+				   title_id.attach(base, size, off, rows) &&
+				   description_id.attach(base, size, off, rows) &&
+				   user_id.attach(base, size, off, rows);
+		}
+
+		void detach()
+		{
+			click.detach();
+			impression.detach();
+			display_url.detach();
+			ad_id.detach();
+			advertiser_id.detach();
+			depth.detach();
+			position.detach();
+			query_id.detach();
+			keyword_id.detach();
+			title_id.detach();
+			description_id.detach();
+			user_id.detach();
+		}
+		#endif
+
+	private:
+		void resize(size_t rows)
+		{
+			click.resize(rows);
+			impression.resize(rows);
+			display_url.resize(rows);
+			ad_id.resize(rows);
+			advertiser_id.resize(rows);
+			depth.resize(rows);
+			position.resize(rows);
+			query_id.resize(rows);
+			keyword_id.resize(rows);
+			title_id.resize(rows);
+			description_id.resize(rows);
+			user_id.resize(rows);
+		}
+
+		void set(size_t row, const Entry& entry)
+		{
+			click.set(row, entry.click);
+			impression.set(row, entry.impression);
+			display_url.set(row, entry.display_url);
+			ad_id.set(row, entry.ad_id);
+			advertiser_id.set(row, entry.advertiser_id);
+			depth.set(row, entry.depth);
+			position.set(row, entry.position);
+			query_id.set(row, entry.query_id);
+			keyword_id.set(row, entry.keyword_id);
+			title_id.set(row, entry.title_id);
+			description_id.set(row, entry.description_id);
+			user_id.set(row, entry.user_id);
+		}
+
+		// Friend classes
+		friend class KDD;
+	};
+	#endif
+
+	#ifdef GET_INDEX
+	// Key of the get index, the tuple filtered by get()
+	struct GetKey
+	{
+		TKey user_id;
+		TKey ad_id;
+		TKey query_id;
+		unsigned short position;
+		unsigned short depth;
+	};
+
+	// Compare function for GetKey
+	struct GetKeyComparer
+	{
+		bool operator()(const GetKey& k1, const GetKey& k2) const
+		{
+			if(k1.user_id != k2.user_id)
+				return k1.user_id < k2.user_id;
+			else if(k1.ad_id != k2.ad_id)
+				return k1.ad_id < k2.ad_id;
+			else if(k1.query_id != k2.query_id)
+				return k1.query_id < k2.query_id;
+			else if(k1.position != k2.position)
+				return k1.position < k2.position;
+			else
+				return k1.depth < k2.depth;
+		}
+	};
+
+	// Sums of the lines sharing a GetKey
+	struct GetSum
+	{
+		unsigned long clicks;
+		unsigned long impressions;
+
+		GetSum& operator+=(const GetSum& other)
+		{
+			clicks += other.clicks;
+			impressions += other.impressions;
+			return *this;
+		}
+	};
+	#endif
+
+	#ifdef PROFIT_INDEX
+	// Key of the profit index, the click-through rate summed over the lines
+	// of a user and an ad.
+	struct ProfitKey
+	{
+		TKey ad_id;
+		double ctr;
+	};
+
+	// Compare function for ProfitKey, the rates of an ad are in descending
+	// order so the users above a threshold come first.
+	struct ProfitKeyComparer
+	{
+		bool operator()(const ProfitKey& k1, const ProfitKey& k2) const
+		{
+			if(k1.ad_id != k2.ad_id)
+				return k1.ad_id < k2.ad_id;
+			else
+				return k1.ctr > k2.ctr;
+		}
+	};
+	#endif
+
+	// Index from a key to the values of the lines holding it. It is either a
+	// tree built in memory, or a read-only view searching the image of such a
+	// tree in the mapped snapshot.
+	template <typename TValue, typename TIndexKey = TKey, typename TCompare = std::less<TIndexKey> >
+	class Index
+	{
+	public:
+		#ifndef NODE_POOL
+		typedef std::allocator<std::pair<TIndexKey, TValue> > Allocator;
+		#else
+		typedef stx::btree_pool_allocator<std::pair<TIndexKey, TValue> > Allocator;
+		#endif
+		typedef stx::btree_multimap<TIndexKey, TValue, 
+									TCompare, 
+									struct btree_traits_speed<INNER_SLOTS, LEAF_SLOTS>,
+									Allocator> Tree;
+		#ifndef FROZEN
+		typedef typename Tree::image_type Image;
+		#else
+		// Packed from the tree once it is built, or attached to the snapshot
+		typedef stx::btree_frozen<TIndexKey, TValue,
+								  TCompare,
+								  struct btree_traits_speed<INNER_SLOTS, LEAF_SLOTS> > Image;
+		#endif
+
+	private:
+		Tree tree;
+		Image image;
+
+	public:
+		// The tree to be built, it is left empty while an image is attached.
+		Tree& get_tree()
+		{
+			return tree;
+		}
+
+		#ifdef FROZEN
+		// Pack the built tree into the frozen arrays and drop it, the index is
+		// only read from here on.
+		void freeze()
+		{
+			image.assign(tree.begin(), tree.end());
+			tree.clear();
+		}
+		#endif
+
+		size_t size() const
+		{
+			return image.attached() ? image.size() : tree.size();
+		}
+
+		// Attach to the image at data and drop the tree. Returns the size of
+		// the image, or 0 if it doesn't match.
+		size_t attach(const char* data, size_t size)
+		{
+			size_t image_size = image.attach(data, size);
+			if(image_size > 0)
+				tree.clear();
+			return image_size;
+		}
+
+		void detach()
+		{
+			image.detach();
+		}
+
+		void dump_image(std::ostream& os) const
+		{
+			#ifndef FROZEN
+			tree.dump_image(os);
+			#else
+			image.dump_image(os);
+			#endif
+		}
+
+		// Copy the values of all items with the key to out.
+		template <typename OutputIterator>
+		OutputIterator lookup(const TIndexKey& key, OutputIterator out) const
+		{
+			if(image.attached())
+				return copy_values(image.equal_range(key), out);
+			else
+				return copy_values(tree.equal_range(key), out);
+		}
+
+		// Copy the values of the items with each of the keys to out, key after
+		// key, and append the number of values of every key to counts unless
+		// it is NULL. The keys descend the tree in groups, so the cache misses
+		// of their lookups overlap.
+		template <typename ForwardIterator, typename OutputIterator>
+		OutputIterator lookup_many(ForwardIterator kbegin, ForwardIterator kend, OutputIterator out,
+								   std::vector<size_t>* counts = NULL) const
+		{
+			if(image.attached())
+				return copy_ranges(image, kbegin, kend, out, counts);
+			else
+				return copy_ranges(tree, kbegin, kend, out, counts);
+		}
+
+	private:
+		template <typename Range, typename OutputIterator>
+		static OutputIterator copy_values(const Range& range, OutputIterator out)
+		{
+			for(auto it = range.first; it != range.second; ++it)
+				*out++ = it->second;
+			return out;
+		}
+
+		template <typename Searchable, typename ForwardIterator, typename OutputIterator>
+		static OutputIterator copy_ranges(const Searchable& searchable, ForwardIterator kbegin, ForwardIterator kend,
+										  OutputIterator out, std::vector<size_t>* counts)
+		{
+			typedef typename Searchable::const_iterator Iterator;
+			std::vector<std::pair<Iterator, Iterator> > ranges;
+			searchable.multi_equal_range(kbegin, kend, std::back_inserter(ranges));
+			for(const auto& range : ranges)
+			{
+				out = copy_values(range, out);
+				if(counts != NULL)
+					counts->push_back(std::distance(range.first, range.second));
+			}
+			return out;
+		}
+
+	public:
+		// Copy the values of all items from the first key not less than lower
+		// up to the first key not less than upper to out.
+		template <typename OutputIterator>
+		OutputIterator scan(const TIndexKey& lower, const TIndexKey& upper, OutputIterator out) const
+		{
+			if(image.attached())
+				return copy_values(std::make_pair(image.lower_bound(lower), image.lower_bound(upper)), out);
+			else
+				return copy_values(std::make_pair(tree.lower_bound(lower), tree.lower_bound(upper)), out);
+		}
+	};
+
+	#ifdef POSTING_LIST
+	// Index from a key to the ascending values of the lines holding it, kept
+	// as one compressed posting list per key. Like Index it is either built
+	// in memory or a view of its image in the mapped snapshot.
+	template <typename TValue, typename TIndexKey = TKey>
+	class PostingIndex
+	{
+	public:
+		#ifndef NODE_POOL
+		typedef std::allocator<std::pair<TIndexKey, stx::btree_posting_ref> > Allocator;
+		#else
+		typedef stx::btree_pool_allocator<std::pair<TIndexKey, stx::btree_posting_ref> > Allocator;
+		#endif
+		typedef stx::btree_posting_multimap<TIndexKey, TValue,
+											std::less<TIndexKey>,
+											struct btree_traits_speed<INNER_SLOTS, LEAF_SLOTS>,
+											Allocator> Tree;
+		typedef typename Tree::image_type Image;
+
+	private:
+		Tree tree;
+		Image image;
+
+	public:
+		// The posting lists to be built, left empty while an image is attached.
+		Tree& get_tree()
+		{
+			return tree;
+		}
+
+		size_t size() const
+		{
+			return image.attached() ? image.size() : tree.size();
+		}
+
+		// Attach to the image at data and drop the posting lists. Returns the
+		// size of the image, or 0 if it doesn't match.
+		size_t attach(const char* data, size_t size)
+		{
+			size_t image_size = image.attach(data, size);
+			if(image_size > 0)
+				tree.clear();
+			return image_size;
+		}
+
+		void detach()
+		{
+			image.detach();
+		}
+
+		void dump_image(std::ostream& os) const
+		{
+			tree.dump_image(os);
+		}
+
+		// Copy the values of the key to out, in ascending order.
+		template <typename OutputIterator>
+		OutputIterator lookup(const TIndexKey& key, OutputIterator out) const
+		{
+			typename Tree::posting_list list = image.attached() ? image.equal_range(key) : tree.equal_range(key);
+			return std::copy(list.begin(), list.end(), out);
+		}
+
+		// Copy the values of each of the keys to out, key after key, and
+		// append the number of values of every key to counts unless it is
+		// NULL. The keys are searched in groups like Index::lookup_many().
+		template <typename ForwardIterator, typename OutputIterator>
+		OutputIterator lookup_many(ForwardIterator kbegin, ForwardIterator kend, OutputIterator out,
+								   std::vector<size_t>* counts = NULL) const
+		{
+			std::vector<typename Tree::posting_list> lists;
+			if(image.attached())
+				image.multi_equal_range(kbegin, kend, std::back_inserter(lists));
+			else
+				tree.multi_equal_range(kbegin, kend, std::back_inserter(lists));
+
+			for(const auto& list : lists)
+			{
+				out = std::copy(list.begin(), list.end(), out);
+				if(counts != NULL)
+					counts->push_back(list.size());
+			}
+			return out;
+		}
+	};
+	#endif
+
+	class Database
+	{
+	private:
+        #ifndef MMF
+        std::ifstream stream;
+        #else
+        MemoryMappedFile mmf;
+        #endif
+        #if defined(ROW_INDEX) && !defined(COLUMNAR)
+        RowIndex row_index;
+        #endif
+        #ifdef INDEX_SNAPSHOT
+        MemoryMappedFile snapshot;
+        #endif
+        #ifndef POSTING_LIST
+        Index<TData> map, ad_id_map;
+        Index<TKey> user_id_ad_id_map;
+        #else
+        PostingIndex<TData> map, ad_id_map;
+        PostingIndex<TKey> user_id_ad_id_map;
+        #endif
+        #ifdef GET_INDEX
+        Index<GetSum, GetKey, GetKeyComparer> get_map;
+        #endif
+        #ifdef PROFIT_INDEX
+        Index<TKey, ProfitKey, ProfitKeyComparer> profit_map;
+        #endif
+        #ifdef COLUMNAR
+        Columns columns;
+        #endif
+
+	public:
+		Database(const std::string& file_path)
+		{
+			#ifndef MMF
+			stream.open(file_path, std::ifstream::in);
+			if(!stream.is_open())
+				throw std::runtime_error("Database(): Fail to open file.");
+			#else
+			mmf.open(file_path);
+			#endif
+			#if defined(ROW_INDEX) && !defined(COLUMNAR)
+			row_index.bind(mmf);
+			#endif
+
+			#ifdef INDEX_SNAPSHOT
+			if(load_snapshot(file_path))
+				return;
+			#endif
+			construct_tree();
+			#ifdef INDEX_SNAPSHOT
+			save_snapshot(file_path);
+			#endif
+		}
+
+		~Database()
+		{
+		}
+
+		#ifndef MMF
+		std::ifstream& get_stream()
+		{
+			return stream;
+		}
+		#endif
+
+		#ifdef INDEX_SNAPSHOT
+		// Map the snapshot of the data file and search the index images in
+		// place, nothing is deserialized. Returns false if there is no snapshot
+		// or it is outdated, the indexes are left empty and the snapshot is
+		// unmapped so its space is released once it is replaced.
+		bool load_snapshot(const std::string& file_path)
+		{
+			struct stat st, snapshot_st;
+			std::string snapshot_path = file_path + SNAPSHOT_SUFFIX;
+			if(stat(file_path.c_str(), &st) != 0 ||
+			   stat(snapshot_path.c_str(), &snapshot_st) != 0 ||
+			   (size_t)snapshot_st.st_size < SNAPSHOT_ALIGNMENT)
+				return false;
+
+			try
+			{
+				snapshot.open(snapshot_path);
+			}
+			catch(std::runtime_error&)
+			{
+				snapshot.close();
+				return false;
+			}
+
+			SnapshotHeader expected;
+			expected.fill(st);
+			if(!expected.same(*reinterpret_cast<const SnapshotHeader*>(snapshot.begin())))
+			{
+				#ifdef DEBUG
+				std::cout << "Snapshot is outdated." << std::endl;
+				#endif
+				snapshot.close();
+				return false;
+			}
+
+			size_t off = SNAPSHOT_ALIGNMENT;
+			bool attached = attach_image(map, off) && attach_image(ad_id_map, off) && attach_image(user_id_ad_id_map, off);
+			#ifdef GET_INDEX
+			attached = attached && attach_image(get_map, off);
+			#endif
+			#ifdef PROFIT_INDEX
+			attached = attached && attach_image(profit_map, off);
+			#endif
+			#if defined(ROW_INDEX) && !defined(COLUMNAR)
+			attached = attached && attach_image(row_index, off);
+			#endif
+			#ifdef COLUMNAR
+			attached = attached && columns.attach(snapshot.begin(), snapshot.size(), off);
+			#endif
+			if(attached)
+			{
+				#ifdef DEBUG
+				std::cout << "Indexes attached to the snapshot." << std::endl;
+				#endif
+				return true;
+			}
+
+			map.detach();
+			ad_id_map.detach();
+			user_id_ad_id_map.detach();
+			#ifdef GET_INDEX
+			get_map.detach();
+			#endif
+			#ifdef PROFIT_INDEX
+			profit_map.detach();
+			#endif
+			#if defined(ROW_INDEX) && !defined(COLUMNAR)
+			row_index.detach();
+			#endif
+			#ifdef COLUMNAR
+			columns.detach();
+			#endif
+			snapshot.close();
+			return false;
+		}
+
+		// Attach the index to the image at off in the snapshot and move off to
+		// the next image.
+		template <typename TIndex>
+		bool attach_image(TIndex& index, size_t& off)
+		{
+			if(off >= snapshot.size())
+				return false;
+
+			size_t image_size = index.attach(snapshot.begin() + off, snapshot.size() - off);
+			if(image_size == 0)
+				return false;
+
+			off = SnapshotHeader::align(off + image_size);
+			return true;
+		}
+
+		// Write the snapshot of the indexes. It goes to a temporary file first
+		// so a concurrent start never sees a partial snapshot, a failure only
+		// costs the next start a full parse.
+		void save_snapshot(const std::string& file_path) const
+		{
+			struct stat st;
+			if(stat(file_path.c_str(), &st) != 0)
+				return;
+
+			std::string snapshot_path = file_path + SNAPSHOT_SUFFIX;
+			std::string temp_path = snapshot_path + ".tmp";
+			{
+				std::ofstream os(temp_path, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+				if(!os.is_open())
+					return;
+
+				SnapshotHeader header;
+				header.fill(st);
+				os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+				SnapshotHeader::pad(os);
+				map.dump_image(os);
+				SnapshotHeader::pad(os);
+				ad_id_map.dump_image(os);
+				SnapshotHeader::pad(os);
+				user_id_ad_id_map.dump_image(os);
+				#ifdef GET_INDEX
+				SnapshotHeader::pad(os);
+				get_map.dump_image(os);
+				#endif
+				#ifdef PROFIT_INDEX
+				SnapshotHeader::pad(os);
+				profit_map.dump_image(os);
+				#endif
+				#if defined(ROW_INDEX) && !defined(COLUMNAR)
+				SnapshotHeader::pad(os);
+				row_index.dump_image(os);
+				#endif
+				#ifdef COLUMNAR
+				SnapshotHeader::pad(os);
+				columns.dump(os);
+				#endif
+
+				if(!os.good())
+				{
+					os.close();
+					std::remove(temp_path.c_str());
+					return;
+				}
+			}
+
+			if(std::rename(temp_path.c_str(), snapshot_path.c_str()) != 0)
+				std::remove(temp_path.c_str());
+			#ifdef DEBUG
+			else
+				std::cout << "Snapshot written to " << snapshot_path << std::endl;
+			#endif
+		}
+		#endif
+
+		void construct_tree()
+		{
+
+			#ifdef DEBUG
+			std::cout << "Start constructing tree..." << std::endl;
+			#endif
+
+			#ifndef MMF
+			#ifdef DEBUG
+			// Counter for cycles
+			int counter = 0;
+			#endif
+
+			TData currentPos = 0;
+			std::string new_line;
+			// Lines of a user often come in a row, their leaf is tried first
+			auto hint = map.get_tree().end();
+			while(!stream.eof())
+			{
+				// Get the position of current line
+				currentPos = stream.tellg();
+				std::getline(stream, new_line);
+
+				// Skip blank line
+				if(new_line.length() == 0)
+					continue;
+
+				hint = map.get_tree().insert(hint, std::make_pair(parse_field<TKey, USER_ID>(new_line, DELIM), currentPos));
+
+				#ifdef DEBUG
+				counter++;
+				if((counter % NOTICE_PER_LINE) == 0)
+					std::cout << "Item " << counter << " inserted." << std::endl;
+				#ifdef PAUSE_AT_RATIO
+				if((counter / NOTICE_PER_LINE) == PAUSE_AT_RATIO)
+					break;
+				#endif
+				#endif
+			}
+			#else
+			#if defined(ROW_INDEX) && !defined(COLUMNAR)
+			row_index.build();
+			#endif
+
+			const char* head = mmf.begin();
+			const char* tail = mmf.end();
+
+			// Split the mapped file into one chunk per thread, every boundary
+			// is moved right behind a newline so no line is shared by chunks.
+			int num_chunks = omp_get_max_threads();
+			std::vector<const char*> bounds(num_chunks + 1, tail);
+			bounds[0] = head;
+			for(int idx = 1; idx < num_chunks; idx++)
+			{
+				const char* pos = std::max(head + mmf.size() / num_chunks * idx, bounds[idx - 1]);
+				pos = end_of_line(pos, tail);
+				bounds[idx] = (pos == tail) ? tail : pos + 1;
+			}
+
+			// Lists parsed from each chunk, kept in file order
+			std::vector<std::vector<std::pair<TKey, TData> > > user_lists(num_chunks), ad_lists(num_chunks);
+			std::vector<std::vector<std::pair<TKey, TKey> > > user_ad_lists(num_chunks);
+			#ifdef GET_INDEX
+			std::vector<std::vector<std::pair<GetKey, GetSum> > > get_lists(num_chunks);
+			#endif
+			#ifdef PROFIT_INDEX
+			std::vector<std::vector<std::pair<std::pair<TKey, TKey>, double> > > profit_lists(num_chunks);
+			#endif
+			#ifdef COLUMNAR
+			// Rows decoded from each chunk, the lists refer to the rows by
+			// their index in the chunk until the chunks are joined.
+			std::vector<std::vector<Entry> > rows(num_chunks);
+			#endif
+			bool malformed = false;
+
+			#pragma omp parallel for schedule(static, 1)
+			for(int idx = 0; idx < num_chunks; idx++)
+			{
+				try
+				{
+					#if defined(ROW_INDEX) && !defined(COLUMNAR)
+					TData row = row_index.first_row(bounds[idx]);
+					#endif
+					for(const char* line = bounds[idx]; line < bounds[idx + 1]; )
+					{
+						const char* eol = end_of_line(line, bounds[idx + 1]);
+
+						// Skip blank line
+						if(eol != line)
+						{
+							#if defined(COLUMNAR)
+							rows[idx].push_back(Entry(line, eol));
+							const Entry& entry = rows[idx].back();
+							TData currentPos = rows[idx].size() - 1;
+							#elif defined(ROW_INDEX)
+							Entry entry(line, eol);
+							TData currentPos = row++;
+							#else
+							Entry entry(line, eol);
+							TData currentPos = line - head;
+							#endif
+							TKey user = entry.get_user_id();
+							TKey ad = entry.get_ad_id();
+
+							user_lists[idx].push_back(std::make_pair(user, currentPos));
+							ad_lists[idx].push_back(std::make_pair(ad, currentPos));
+							user_ad_lists[idx].push_back(std::make_pair(user, ad));
+							#ifdef GET_INDEX
+							GetKey key = { user, ad, entry.get_query_id(), entry.get_position(), entry.get_depth() };
+							GetSum sum = { entry.get_click(), entry.get_impression() };
+							get_lists[idx].push_back(std::make_pair(key, sum));
+							#endif
+							#ifdef PROFIT_INDEX
+							double ctr = (double)entry.get_click() / entry.get_impression();
+							profit_lists[idx].push_back(std::make_pair(std::make_pair(ad, user), ctr));
+							#endif
+						}
+
+						line = eol + 1;
+					}
+				}
+				catch(std::runtime_error&)
+				{
+					// Exceptions can't leave the parallel region, report later.
+					#pragma omp critical
+					malformed = true;
+				}
+
+				#ifdef DEBUG
+				#pragma omp critical
+				std::cout << "Chunk " << idx << ": " << user_lists[idx].size() << " lines parsed." << std::endl;
+				#endif
+			}
+
+			if(malformed)
+				throw std::runtime_error("construct_tree(): Malformed line in the file.");
+
+			#ifdef COLUMNAR
+			// Join the chunks into the columns, the rows of each chunk follow
+			// the rows of the chunks before it.
+			std::vector<TData> row_base(num_chunks, 0);
+			for(int idx = 1; idx < num_chunks; idx++)
+				row_base[idx] = row_base[idx - 1] + rows[idx - 1].size();
+			columns.assign(rows);
+			#ifdef ROW_INDEX
+			if(columns.size() > (size_t)std::numeric_limits<TData>::max())
+				throw std::runtime_error("construct_tree(): Too many lines for the row ids.");
+			#endif
+
+			#pragma omp parallel for
+			for(int idx = 1; idx < num_chunks; idx++)
+			{
+				for(auto& elem : user_lists[idx])
+					elem.second += row_base[idx];
+				for(auto& elem : ad_lists[idx])
+					elem.second += row_base[idx];
+			}
+			#endif
+
+			#ifdef BULK_LOAD
+			// Sort the parsed lists and load them into nearly full leaves, the
+			// sorting itself is parallel so the indexes are built one by one.
+			bulk_load_index(map.get_tree(), user_lists);
+			bulk_load_index(ad_id_map.get_tree(), ad_lists);
+			bulk_load_index(user_id_ad_id_map.get_tree(), user_ad_lists);
+			#else
+			// The indexes are independent, so each of them is built by its own
+			// thread. Every insert is hinted with the leaf of the last one.
+			#pragma omp parallel sections
+			{
+				#pragma omp section
+				{
+					insert_hinted(map.get_tree(), user_lists);
+				}
+
+				#pragma omp section
+				{
+					insert_hinted(ad_id_map.get_tree(), ad_lists);
+				}
+
+				#pragma omp section
+				{
+					insert_hinted(user_id_ad_id_map.get_tree(), user_ad_lists);
+				}
+			}
+			#endif
+
+			#ifdef GET_INDEX
+			// Lines of the same tuple are summed up before loading
+			bulk_load_sums(get_map.get_tree(), get_lists);
+			#endif
+
+			#ifdef PROFIT_INDEX
+			bulk_load_profits(profit_map.get_tree(), profit_lists);
+			#endif
+			#endif
+
+			#ifdef FROZEN
+			// The indexes are only read from here on
+			#ifndef POSTING_LIST
+			map.freeze();
+			ad_id_map.freeze();
+			user_id_ad_id_map.freeze();
+			#endif
+			#ifdef GET_INDEX
+			get_map.freeze();
+			#endif
+			#ifdef PROFIT_INDEX
+			profit_map.freeze();
+			#endif
+			#endif
+
+			#ifdef DEBUG
+			std::cout << "... Complete!" << std::endl;
+			#endif
 		}
 
-		unsigned int get_title_id() const
+		#ifdef MMF
+		// Concatenate the per-chunk lists, sort them by key and bulk load the
+		// tree. The lists are released on the way to cap the peak memory.
+		template <typename Tree, typename Pair>
+		static void bulk_load_index(Tree& tree, std::vector<std::vector<Pair> >& lists)
 		{
-			return title_id;
+			std::vector<Pair> pairs = join_lists(lists);
+			__gnu_parallel::sort(pairs.begin(), pairs.end());
+			load_sorted(tree, pairs);
 		}
 
-		unsigned int get_description_id() const
+		#ifndef BULK_LOAD
+		// Insert the per-chunk lists in file order, every insert hinted with
+		// the leaf of the last one so runs of a key skip the descent.
+		template <typename Tree, typename Pair>
+		static void insert_hinted(Tree& tree, const std::vector<std::vector<Pair> >& lists)
 		{
-			return description_id;
+			typename Tree::iterator hint = tree.end();
+			for(const auto& list : lists)
+				for(const auto& elem : list)
+					hint = tree.insert(hint, elem);
 		}
+		#endif
 
-		unsigned int get_user_id() const
+		// Like bulk_load_index(), but the values of equal keys are summed up
+		// so every key is loaded once.
+		template <typename Tree, typename Pair>
+		static void bulk_load_sums(Tree& tree, std::vector<std::vector<Pair> >& lists)
 		{
-			return user_id;
+			std::vector<Pair> pairs = join_lists(lists);
+			typename Tree::key_compare less = tree.key_comp();
+			__gnu_parallel::sort(pairs.begin(), pairs.end(),
+								 [&less](const Pair& lhs, const Pair& rhs)
+								 	{
+								 		return less(lhs.first, rhs.first);
+								 	});
+
+			size_t count = 0;
+			for(size_t idx = 0; idx < pairs.size(); idx++)
+			{
+				if(count > 0 && !less(pairs[count - 1].first, pairs[idx].first))
+					pairs[count - 1].second += pairs[idx].second;
+				else
+					pairs[count++] = pairs[idx];
+			}
+			pairs.resize(count);
+
+			load_sorted(tree, pairs);
 		}
 
-	public:
-		Entry()
+		#ifdef PROFIT_INDEX
+		// Sum the click-through rates of every ad and user, line by line in
+		// file order just like profit() would, and load the sums ordered by
+		// ad and descending rate. A sum that isn't a number never passes a
+		// threshold and is left out.
+		template <typename Tree, typename Rate>
+		static void bulk_load_profits(Tree& tree, std::vector<std::vector<Rate> >& lists)
 		{
+			std::vector<Rate> rates = join_lists(lists);
+			__gnu_parallel::stable_sort(rates.begin(), rates.end(),
+										[](const Rate& lhs, const Rate& rhs)
+											{
+												return lhs.first < rhs.first;
+											});
+
+			std::vector<std::pair<ProfitKey, TKey> > pairs;
+			for(size_t idx = 0; idx < rates.size(); )
+			{
+				size_t next = idx;
+				double sum = 0.0;
+				for(; next < rates.size() && rates[next].first == rates[idx].first; next++)
+					sum += rates[next].second;
+
+				if(sum == sum)
+				{
+					ProfitKey key = { rates[idx].first.first, sum };
+					pairs.push_back(std::make_pair(key, rates[idx].first.second));
+				}
+				idx = next;
+			}
+			std::vector<Rate>().swap(rates);
+
+			typename Tree::key_compare less = tree.key_comp();
+			__gnu_parallel::sort(pairs.begin(), pairs.end(),
+								 [&less](const std::pair<ProfitKey, TKey>& lhs, const std::pair<ProfitKey, TKey>& rhs)
+								 	{
+								 		if(less(lhs.first, rhs.first))
+								 			return true;
+								 		else if(less(rhs.first, lhs.first))
+								 			return false;
+								 		else
+								 			return lhs.second < rhs.second;
+								 	});
+
+			load_sorted(tree, pairs);
 		}
+		#endif
 
-		// TODO: Direct extraction
-		Entry(const std::string& entry)
+		// Concatenate the per-chunk lists in order, they are released on the way.
+		template <typename Pair>
+		static std::vector<Pair> join_lists(std::vector<std::vector<Pair> >& lists)
 		{
-			std::istringstream iss(entry);
-			iss >> click >> impression 
-			    >> display_url >> ad_id >> advertiser_id
-			    >> depth >> position
-			    >> query_id >> keyword_id >> title_id
-			    >> description_id
-			    >> user_id;
+			std::vector<size_t> offsets(lists.size() + 1, 0);
+			for(size_t idx = 0; idx < lists.size(); idx++)
+				offsets[idx + 1] = offsets[idx] + lists[idx].size();
+
+			std::vector<Pair> pairs(offsets.back());
+			#pragma omp parallel for
+			for(int idx = 0; idx < (int)lists.size(); idx++)
+			{
+				std::copy(lists[idx].begin(), lists[idx].end(), pairs.begin() + offsets[idx]);
+				std::vector<Pair>().swap(lists[idx]);
+			}
+
+			return pairs;
 		}
 
-		// Functions for filtering
-		bool isGet(unsigned int _user_id,
-				   unsigned int _ad_id,
-				   unsigned int _query_id,
-				   unsigned char _position,
-				   unsigned char _depth) const
+		template <typename Tree, typename Pair>
+		static void load_sorted(Tree& tree, const std::vector<Pair>& pairs)
 		{
-			return (_user_id == user_id) &&
-				   (_ad_id == ad_id) &&
-				   (_query_id == query_id) &&
-				   (_position == position) &&
-				   (_depth == depth);
+			tree.bulk_load(pairs.begin(), pairs.end());
+
+			#ifdef DEBUG
+			std::cout << "Index loaded: " << tree.size() << " items, "
+					  << tree.get_stats().leaves << " leaves, "
+					  << tree.get_stats().innernodes << " inner nodes." << std::endl;
+			#endif
 		}
 
-		bool hasClicked() const
+		// Position of the newline terminating the line at ptr, or end if the
+		// line isn't terminated.
+		static const char* end_of_line(const char* ptr, const char* end)
 		{
-			return click > 0;
+			const char* eol = reinterpret_cast<const char*>(memchr(ptr, NEWLINE, end - ptr));
+			return (eol == NULL) ? end : eol;
 		}
+		#endif
 
-		bool hasImpression() const
+		#ifndef MMF
+		template <typename FieldType, enum field Field>
+		FieldType parse_field(std::string &str, const char& delim)
 		{
-			return impression > 0;
+			static_assert(std::is_same<FieldType, unsigned char>::value ||
+						  std::is_same<FieldType, unsigned short>::value ||
+						  std::is_same<FieldType, unsigned int>::value || 
+						  std::is_same<FieldType, unsigned long long>::value,
+						  "parse_field(): Designated template type isn't acceptable.");
+
+			FieldType result = 0;
+			int ptr = 0;
+
+			// Shift to desired field according to deliminator.
+			for(int idx = 0; idx < Field; ptr++)
+			{
+				if(str[ptr] == delim)
+					idx++;
+				if(str[ptr] == NEWLINE)
+					throw std::runtime_error("parse_field(): Field out of range.");
+			}
+
+			// Start extracting the number.
+			// Stop when: deliminator, newline character, end-of-string, is found.
+			for(; str[ptr] != delim && 
+				  str[ptr] != NEWLINE && 
+				  str[ptr] != '\0'; ptr++)
+			{
+				result *= 10;
+				result += str[ptr] - '0';
+			}
+
+			return result;
 		}
+		#endif
+
+		// Friend classes
+		friend class KDD;
 	};
 
 	class KDD
@@ -473,6 +1826,19 @@ namespace dsa
 	// get()
 	//
 	private:
+		// Decode the row an index refers to. This is stateless, so rows can
+		// be decoded by several threads at once.
+		static Entry _entry_at(const Database& database, TData pos)
+		{
+			#if defined(COLUMNAR)
+			return database.columns.row(pos);
+			#elif defined(ROW_INDEX)
+			return Entry(database.row_index.line_at(pos), database.row_index.line_end(pos));
+			#else
+			return Entry(database.mmf.line_at(pos), database.mmf.line_end(pos));
+			#endif
+		}
+
 		static std::vector<Entry> _filter_by_user_id_wrapper(Database& database, unsigned int _user_id)
 		{
 			#ifndef MMF
@@ -481,48 +1847,16 @@ namespace dsa
 			#endif
 
 			// Search in the database
-			auto range = database.map.equal_range(_user_id);
-
 			std::vector<TData> list;
-			for(auto it = range.first; it != range.second; ++it)
-				list.push_back(it->second);
+			database.map.lookup(_user_id, std::back_inserter(list));
 
-			// Start conversion
-			/*
+			// Start conversion, every row goes to its own slot so the result
+			// keeps the order of the index.
 			int size = list.size();
 			std::vector<Entry> result(size);
-			#pragma omp parallel for shared(result, database, list)
-			for(int idx = 0; idx < size; ++idx) 
-			{
-			    database.mmf.seekg(list[idx]);
-				result[idx] = Entry(database.mmf.getline());
-			}
-			*/
-
-			std::vector<Entry> result;
-			#pragma omp parallel
-			{
-			    std::vector<Entry> result_private;
-			    for(auto it = range.first; it != range.second; ++it)
-				#pragma omp single nowait
-				{
-					database.mmf.seekg(it->second);
-					result_private.push_back(Entry(database.mmf.getline()));
-				}
-
-			    #pragma omp critical
-			    result.insert(result.end(), result_private.begin(), result_private.end());
-			}
-			
-			/*
-			__gnu_parallel::for_each(range.first, range.second, 
-									 [&result, &database](std::pair<TKey, TData>& elem)
-									 {
-										database.mmf.seekg(elem.second);
-										//#pragma omp critical
-										result.push_back(Entry(database.mmf.getline()));
-									 });
-			*/
+			#pragma omp parallel for if(size >= PARALLEL_DECODE)
+			for(int idx = 0; idx < size; ++idx)
+				result[idx] = _entry_at(database, list[idx]);
 
 			return result;
 		}
@@ -532,12 +1866,56 @@ namespace dsa
 		static std::pair<unsigned int, unsigned long> get(Database& database,
 														  unsigned int _user_id,
 												   		  unsigned int _ad_id, unsigned int _query_id,
-												   		  unsigned char _position, unsigned char _depth)
+												   		  unsigned short _position, unsigned short _depth)
+		{
+			unsigned int clicks = 0;
+			unsigned long impression = 0;
+
+			#if defined(GET_INDEX)
+			// The sums of the whole tuple are looked up at once
+			GetKey key = { _user_id, _ad_id, _query_id, _position, _depth };
+			std::vector<GetSum> sums;
+			database.get_map.lookup(key, std::back_inserter(sums));
+			for(const auto& sum : sums)
+			{
+				clicks += sum.clicks;
+				impression += sum.impressions;
+			}
+			#elif !defined(COLUMNAR)
+			return _get_from(_filter_by_user_id_wrapper(database, _user_id),
+							 _user_id, _ad_id, _query_id, _position, _depth);
+			#else
+			// Only the columns in the filter are touched
+			const Columns& columns = database.columns;
+			std::vector<TData> rows;
+			database.map.lookup(_user_id, std::back_inserter(rows));
+			for(const auto& row : rows)
+			{
+				if((columns.ad_id[row] == _ad_id) &&
+				   (columns.query_id[row] == _query_id) &&
+				   (columns.position[row] == _position) &&
+				   (columns.depth[row] == _depth))
+				{
+					clicks += columns.click[row];
+					impression += columns.impression[row];
+				}
+			}
+			#endif
+
+			return std::make_pair(clicks, impression);
+		}
+
+	private:
+		// Sum of click and impression over the rows of the user.
+		static std::pair<unsigned int, unsigned long> _get_from(const std::vector<Entry>& rows,
+																unsigned int _user_id,
+																unsigned int _ad_id, unsigned int _query_id,
+																unsigned short _position, unsigned short _depth)
 		{
 			unsigned int clicks = 0;
 			unsigned long impression = 0;
 
-			for(const auto& elem : _filter_by_user_id_wrapper(database, _user_id))
+			for(const auto& elem : rows)
 			{
 				if(elem.isGet(_user_id, _ad_id, _query_id, _position, _depth))
 				{
@@ -554,9 +1932,15 @@ namespace dsa
 	//
 	public:
 		static std::vector<std::pair<unsigned int, unsigned int> > clicked(Database& database, unsigned int _user_id)
+		{
+			return _clicked_from(_filter_by_user_id_wrapper(database, _user_id));
+		}
+
+	private:
+		static std::vector<std::pair<unsigned int, unsigned int> > _clicked_from(const std::vector<Entry>& rows)
 		{
 			std::vector<std::pair<unsigned int, unsigned int> > result;
-			for(const auto& elem : _filter_by_user_id_wrapper(database, _user_id))
+			for(const auto& elem : rows)
 			{
 				if(elem.hasClicked())
 					result.push_back(std::make_pair(elem.get_ad_id(), elem.get_query_id()));
@@ -588,20 +1972,20 @@ namespace dsa
 		};
 
 	public:
-		static std::map<unsigned int, std::vector<Entry> > impressed(Database& database,
-																   unsigned int _user_id_1, unsigned int _user_id_2)
+		// Properties of the impressed ads, grouped by ad in ascending order.
+		typedef std::vector<std::pair<unsigned int, std::vector<Entry> > > Impressions;
+
+		static Impressions impressed(Database& database,
+									 unsigned int _user_id_1, unsigned int _user_id_2)
 		{
-			// Dummy map
-			std::map<unsigned int, std::vector<Entry> > result;
+			Impressions result;
 
 			#ifdef DEBUG
 			std::cout << "start searching ads viewed by user 1...";
 			#endif
 			// Search the ad from user 1
-			auto range1 = database.user_id_ad_id_map.equal_range(_user_id_1);
 			std::vector<TKey> user_1_ad_list;
-			for(auto it = range1.first; it != range1.second; it++)
-				user_1_ad_list.push_back(it->second);
+			database.user_id_ad_id_map.lookup(_user_id_1, std::back_inserter(user_1_ad_list));
 			__gnu_parallel::sort(user_1_ad_list.begin(), user_1_ad_list.end());
 			#ifdef DEBUG
 			std::cout << "complete" << std::endl;
@@ -611,10 +1995,8 @@ namespace dsa
 			std::cout << "start searching ads viewed by user 2...";
 			#endif
 			// Search the ad from user 2
-			auto range2 = database.user_id_ad_id_map.equal_range(_user_id_2);
 			std::vector<TKey> user_2_ad_list;
-			for(auto it = range2.first; it != range2.second; it++)
-				user_2_ad_list.push_back(it->second);
+			database.user_id_ad_id_map.lookup(_user_id_2, std::back_inserter(user_2_ad_list));
 			__gnu_parallel::sort(user_2_ad_list.begin(), user_2_ad_list.end());
 			#ifdef DEBUG
 			std::cout << "complete" << std::endl;
@@ -636,51 +2018,64 @@ namespace dsa
 			#ifdef DEBUG
 			std::cout << "start searching for properties..." << std::endl;
 			#endif
-			for(const auto& elem : intersected_ads)
+			// Collect the impressed rows of all the ads, in file order per ad.
+			// The ads are looked up together.
+			std::vector<TData> positions;
+			database.ad_id_map.lookup_many(intersected_ads.begin(), intersected_ads.end(),
+										   std::back_inserter(positions));
+
+			std::vector<Entry> rows;
+			for(const auto& pos : positions)
 			{
-				std::vector<Entry> tmp_vec;
-
-				#ifdef DEBUG
-				std::cout << elem << std::endl;
-				#endif
+				Entry tmp = _entry_at(database, pos);
 
-				auto range = database.ad_id_map.equal_range(elem);
-				for(auto it = range.first; it != range.second; ++it)
+				if((tmp.get_user_id() == _user_id_1) || (tmp.get_user_id() == _user_id_2))
 				{
-					database.mmf.seekg(it->second);
-					Entry tmp(database.mmf.getline());
-
-					if((tmp.get_user_id() == _user_id_1) || (tmp.get_user_id() == _user_id_2))
-					{
-						if(tmp.hasImpression())
-							tmp_vec.push_back(tmp);
-					}
+					if(tmp.hasImpression())
+						rows.push_back(tmp);
 				}
+			}
 
-				// Sort and remove duplicate entries
-				__gnu_parallel::sort(tmp_vec.begin(), tmp_vec.end(), 
-									 [](const Entry&lhs, const Entry& rhs)
-									 	{
-									 		if(lhs.get_advertiser_id() != rhs.get_advertiser_id())
-									 			return lhs.get_advertiser_id() < rhs.get_advertiser_id();
-									 		else if(lhs.get_keyword_id() != rhs.get_keyword_id())
-									 			return lhs.get_keyword_id() < rhs.get_keyword_id();
-									 		else if(lhs.get_title_id() != rhs.get_title_id())
-									 			return lhs.get_title_id() < rhs.get_title_id();
-									 		else
-									 			return lhs.get_description_id() < rhs.get_description_id();
-									 	});
-				tmp_vec.erase(std::unique(tmp_vec.begin(), tmp_vec.end(),
-										   [](const Entry& lhs, const Entry& rhs)
-										   	{
-										   		return (lhs.get_advertiser_id() == rhs.get_advertiser_id()) &&
-										   			   (lhs.get_keyword_id() == rhs.get_keyword_id()) &&
-										   			   (lhs.get_title_id() == rhs.get_title_id()) &&
-										   			   (lhs.get_description_id() == rhs.get_description_id());
-										    }), tmp_vec.end());
+			// Sort all the rows at once by ad and properties, the first row of
+			// duplicate properties is kept.
+			__gnu_parallel::stable_sort(rows.begin(), rows.end(), 
+										[](const Entry&lhs, const Entry& rhs)
+											{
+												if(lhs.get_ad_id() != rhs.get_ad_id())
+													return lhs.get_ad_id() < rhs.get_ad_id();
+												else if(lhs.get_advertiser_id() != rhs.get_advertiser_id())
+													return lhs.get_advertiser_id() < rhs.get_advertiser_id();
+												else if(lhs.get_keyword_id() != rhs.get_keyword_id())
+													return lhs.get_keyword_id() < rhs.get_keyword_id();
+												else if(lhs.get_title_id() != rhs.get_title_id())
+													return lhs.get_title_id() < rhs.get_title_id();
+												else
+													return lhs.get_description_id() < rhs.get_description_id();
+											});
+			rows.erase(std::unique(rows.begin(), rows.end(),
+								   [](const Entry& lhs, const Entry& rhs)
+								   	{
+								   		return (lhs.get_ad_id() == rhs.get_ad_id()) &&
+								   			   (lhs.get_advertiser_id() == rhs.get_advertiser_id()) &&
+								   			   (lhs.get_keyword_id() == rhs.get_keyword_id()) &&
+								   			   (lhs.get_title_id() == rhs.get_title_id()) &&
+								   			   (lhs.get_description_id() == rhs.get_description_id());
+								    }), rows.end());
+
+			// Split the rows into the groups of the ads, an ad without any
+			// impressed row still gets an empty group.
+			result.reserve(intersected_ads.size());
+			auto row = rows.begin();
+			for(const auto& elem : intersected_ads)
+			{
+				auto next = row;
+				while(next != rows.end() && next->get_ad_id() == elem)
+					++next;
+				result.push_back(std::make_pair(elem, std::vector<Entry>(row, next)));
+				row = next;
 
 				#ifdef DEBUG
-				for(const auto& prop : tmp_vec)
+				for(const auto& prop : result.back().second)
 				{
 					std::cout << '\t'
 							  << prop.get_display_url() << ' '
@@ -691,8 +2086,6 @@ namespace dsa
 							  << std::endl;
 				}
 				#endif
-
-				result[elem] = tmp_vec;
 			}
 			#ifdef DEBUG
 			std::cout << "...complete" << std::endl;
@@ -817,9 +2210,9 @@ namespace dsa
 		static std::vector<TKey> profit(Database& database,
 									  unsigned int _ad_id, double _ctr_threshold)
 		{
+			/*
 			std::vector<TKey> lst;
 
-			/*
 			#pragma omp parallel
 			{
 				std::vector<TKey> lst_private;
@@ -851,31 +2244,293 @@ namespace dsa
 			}
 			*/
 
+			#ifdef PROFIT_INDEX
+			// The users above the threshold lead the users of the ad
+			ProfitKey lower = { _ad_id, std::numeric_limits<double>::infinity() };
+			ProfitKey upper = { _ad_id, _ctr_threshold };
+			std::vector<TKey> lst;
+			database.profit_map.scan(lower, upper, std::back_inserter(lst));
+			std::sort(lst.begin(), lst.end());
+			return lst;
+			#else
+			return _profit_from(_ctr_by_user(database, _ad_id), _ctr_threshold);
+			#endif
+		}
+
+	private:
+		// Sum of the click-through rates of the ad per user, in ascending
+		// order of the users.
+		static std::vector<std::pair<TKey, double> > _ctr_by_user(Database& database, unsigned int _ad_id)
+		{
 			// Search in the database
-			auto range = database.ad_id_map.equal_range(_ad_id);
+			std::vector<TData> positions;
+			database.ad_id_map.lookup(_ad_id, std::back_inserter(positions));
 			
-			std::map<unsigned int, double> record;
-			for(auto it = range.first; it != range.second; ++it)
+			std::vector<std::pair<TKey, double> > record;
+			record.reserve(positions.size());
+			for(const auto& pos : positions)
 			{
-				database.mmf.seekg(it->second);
-				Entry tmp(database.mmf.getline());
+				#ifndef COLUMNAR
+				Entry tmp = _entry_at(database, pos);
+				TKey user_id = tmp.get_user_id();
+				double ctr = (double)tmp.get_click() / tmp.get_impression();
+				#else
+				TKey user_id = database.columns.user_id[pos];
+				double ctr = (double)database.columns.click[pos] / database.columns.impression[pos];
+				#endif
+
+				record.push_back(std::make_pair(user_id, ctr));
+			}
+
+			// Group the rates by user, the rates of a user stay in file order
+			// so they are summed up in the same order as ever.
+			std::stable_sort(record.begin(), record.end(),
+							 [](const std::pair<TKey, double>& lhs, const std::pair<TKey, double>& rhs)
+							 	{
+							 		return lhs.first < rhs.first;
+							 	});
 
-				if(record.count(tmp.get_user_id()))
-					record[tmp.get_user_id()] += (double)tmp.get_click() / tmp.get_impression();
+			size_t count = 0;
+			for(size_t idx = 0; idx < record.size(); idx++)
+			{
+				if(count > 0 && record[count - 1].first == record[idx].first)
+					record[count - 1].second += record[idx].second;
 				else
-					record.insert(std::make_pair(tmp.get_user_id(), (double)tmp.get_click() / tmp.get_impression()));
+					record[count++] = record[idx];
 			}
+			record.resize(count);
+
+			return record;
+		}
 
+		// Users whose summed click-through rate is above the threshold, the
+		// record is in order already.
+		static std::vector<TKey> _profit_from(const std::vector<std::pair<TKey, double> >& record, double _ctr_threshold)
+		{
+			std::vector<TKey> lst;
 			for(const auto& elem : record)
 			{
 				if(elem.second > _ctr_threshold)
 					lst.push_back(elem.first);
 			}
 
-			__gnu_parallel::sort(lst.begin(), lst.end());
-
 			return lst;
 		}
+
+	//
+	// batch()
+	//
+	public:
+		// Query of a batch, only the parameters of its type are used.
+		struct Query
+		{
+			enum Type { GET, CLICKED, IMPRESSED, PROFIT } type;
+			unsigned int user_id;		// get, clicked, impressed
+			unsigned int user_id_2;		// impressed
+			unsigned int ad_id;			// get, profit
+			unsigned int query_id;		// get
+			unsigned short position;	// get
+			unsigned short depth;		// get
+			double ctr_threshold;		// profit
+		};
+
+		// Result of a query, only the member of its type is filled.
+		struct Result
+		{
+			std::pair<unsigned int, unsigned long> sums;					// get
+			std::vector<std::pair<unsigned int, unsigned int> > ad_queries;	// clicked
+			Impressions properties;											// impressed
+			std::vector<TKey> users;										// profit
+		};
+
+		// Execute many queries at once, the results are in the order of the
+		// queries. Queries looking up the same index key form a group which
+		// looks the key up and decodes its rows only once, the groups are
+		// executed in the order of their keys by several threads.
+		static std::vector<Result> batch(Database& database, const std::vector<Query>& queries)
+		{
+			std::vector<Result> results(queries.size());
+
+			#ifdef GET_INDEX
+			// get() only looks its tuple up, so all of them are looked up
+			// ahead of the groups.
+			_batch_gets(database, queries, results);
+			#endif
+
+			std::vector<size_t> order;
+			order.reserve(queries.size());
+			for(size_t idx = 0; idx < queries.size(); idx++)
+			{
+				#ifdef GET_INDEX
+				if(queries[idx].type == Query::GET)
+					continue;
+				#endif
+				order.push_back(idx);
+			}
+			std::sort(order.begin(), order.end(),
+					  [&queries](size_t lhs, size_t rhs)
+					  	{
+					  		return _group_of(queries[lhs]) < _group_of(queries[rhs]);
+					  	});
+
+			// Start of every group in the order, followed by the end
+			std::vector<size_t> bounds;
+			for(size_t idx = 0; idx < order.size(); idx++)
+			{
+				if(idx == 0 || _group_of(queries[order[idx - 1]]) != _group_of(queries[order[idx]]))
+					bounds.push_back(idx);
+			}
+			bounds.push_back(order.size());
+
+			#pragma omp parallel for schedule(dynamic)
+			for(int group = 0; group < (int)bounds.size() - 1; group++)
+			{
+				_batch_group(database, queries, 
+							 order.begin() + bounds[group], order.begin() + bounds[group + 1], 
+							 results);
+			}
+
+			return results;
+		}
+
+	private:
+		#ifdef GET_INDEX
+		// Look the sums of all the get() queries up. Every thread takes a
+		// slice of the tuples and looks them up together, so the cache misses
+		// of the lookups overlap.
+		static void _batch_gets(Database& database, const std::vector<Query>& queries,
+								std::vector<Result>& results)
+		{
+			std::vector<size_t> gets;
+			std::vector<GetKey> keys;
+			for(size_t idx = 0; idx < queries.size(); idx++)
+			{
+				const Query& query = queries[idx];
+				if(query.type != Query::GET)
+					continue;
+
+				GetKey key = { query.user_id, query.ad_id, query.query_id, query.position, query.depth };
+				gets.push_back(idx);
+				keys.push_back(key);
+			}
+
+			int num_slices = omp_get_max_threads();
+			#pragma omp parallel for
+			for(int slice = 0; slice < num_slices; slice++)
+			{
+				size_t first = keys.size() * slice / num_slices;
+				size_t last = keys.size() * (slice + 1) / num_slices;
+
+				std::vector<GetSum> sums;
+				std::vector<size_t> counts;
+				database.get_map.lookup_many(keys.begin() + first, keys.begin() + last,
+											 std::back_inserter(sums), &counts);
+
+				auto sum = sums.begin();
+				for(size_t idx = first; idx < last; idx++)
+				{
+					unsigned int clicks = 0;
+					unsigned long impression = 0;
+					for(size_t count = 0; count < counts[idx - first]; count++, ++sum)
+					{
+						clicks += sum->clicks;
+						impression += sum->impressions;
+					}
+					results[gets[idx]].sums = std::make_pair(clicks, impression);
+				}
+			}
+		}
+		#endif
+
+		// Kinds of groups, by what the queries of a group share
+		enum GroupKind { USER_ROWS, GET_LOOKUP, USER_PAIR, AD_ROWS };
+
+		// Group of a query, the kind followed by the shared key.
+		static std::tuple<int, unsigned int, unsigned int> _group_of(const Query& query)
+		{
+			switch(query.type)
+			{
+				case Query::GET:
+					#if defined(GET_INDEX) || defined(COLUMNAR)
+					// Doesn't decode the rows, looked up one by one
+					return std::make_tuple(GET_LOOKUP, query.user_id, query.ad_id);
+					#else
+					return std::make_tuple(USER_ROWS, query.user_id, 0u);
+					#endif
+				case Query::CLICKED:
+					return std::make_tuple(USER_ROWS, query.user_id, 0u);
+				case Query::IMPRESSED:
+					return std::make_tuple(USER_PAIR, query.user_id, query.user_id_2);
+				default:
+					return std::make_tuple(AD_ROWS, query.ad_id, 0u);
+			}
+		}
+
+		template <typename Iterator>
+		static void _batch_group(Database& database, const std::vector<Query>& queries,
+								 Iterator first, Iterator last, std::vector<Result>& results)
+		{
+			const Query& head = queries[*first];
+			switch(std::get<0>(_group_of(head)))
+			{
+				case USER_ROWS:
+				{
+					// get() and clicked() of the user share the decoded rows
+					std::vector<Entry> rows = _filter_by_user_id_wrapper(database, head.user_id);
+					std::vector<std::pair<unsigned int, unsigned int> > ad_queries;
+					bool has_clicked = false;
+					for(Iterator it = first; it != last; ++it)
+					{
+						const Query& query = queries[*it];
+						if(query.type == Query::GET)
+						{
+							results[*it].sums = _get_from(rows, query.user_id, query.ad_id, query.query_id,
+														  query.position, query.depth);
+						}
+						else
+						{
+							if(!has_clicked)
+							{
+								ad_queries = _clicked_from(rows);
+								has_clicked = true;
+							}
+							results[*it].ad_queries = ad_queries;
+						}
+					}
+					break;
+				}
+				case GET_LOOKUP:
+				{
+					for(Iterator it = first; it != last; ++it)
+					{
+						const Query& query = queries[*it];
+						results[*it].sums = get(database, query.user_id, query.ad_id, query.query_id,
+												query.position, query.depth);
+					}
+					break;
+				}
+				case USER_PAIR:
+				{
+					auto properties = impressed(database, head.user_id, head.user_id_2);
+					for(Iterator it = first; it != last; ++it)
+						results[*it].properties = properties;
+					break;
+				}
+				case AD_ROWS:
+				{
+					#ifdef PROFIT_INDEX
+					// Every threshold is a range of its own
+					for(Iterator it = first; it != last; ++it)
+						results[*it].users = profit(database, head.ad_id, queries[*it].ctr_threshold);
+					#else
+					auto record = _ctr_by_user(database, head.ad_id);
+					for(Iterator it = first; it != last; ++it)
+						results[*it].users = _profit_from(record, queries[*it].ctr_threshold);
+					#endif
+					break;
+				}
+			}
+		}
 	};
 }
 
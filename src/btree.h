@@ -42,9 +42,16 @@
 #include <istream>
 #include <ostream>
 #include <memory>
+#include <vector>
 #include <cstddef>
 #include <assert.h>
 
+// *** Vector Instructions for the Intra-Node Search
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 // *** Debugging Macros
 
 #ifdef BTREE_DEBUG
@@ -67,6 +74,38 @@
 
 #endif
 
+// *** Instrumentation Macros
+
+#ifdef BTREE_INSTRUMENT
+
+/// Add n to a counter of the tree_stats if BTREE_INSTRUMENT is defined. The
+/// counters are not atomic, concurrent readers of a tree race on them.
+#define BTREE_COUNT(counter, n) do { m_stats.counter += (n); } while(0)
+
+#else
+
+/// Add n to a counter of the tree_stats if BTREE_INSTRUMENT is defined.
+#define BTREE_COUNT(counter, n) do { } while(0)
+
+#endif
+
+// *** Batched Lookups
+
+#ifndef BTREE_BATCH_GROUP
+/// Number of lookups of the multi_lower_bound() and multi_equal_range()
+/// functions which descend the tree together. It can be overridden before
+/// including the header.
+#define BTREE_BATCH_GROUP       16
+#endif
+
+#if defined(__GNUC__)
+/// Hint the cache line at p to be loaded for reading.
+#define BTREE_PREFETCH(p)       __builtin_prefetch(p)
+#else
+/// Hint the cache line at p to be loaded for reading.
+#define BTREE_PREFETCH(p)       do { } while(0)
+#endif
+
 /// The maximum of a and b. Used in some compile-time formulas.
 #define BTREE_MAX(a,b)          ((a) < (b) ? (b) : (a))
 
@@ -140,6 +179,480 @@ struct btree_default_map_traits
     static const size_t binsearch_threshold = 256;
 };
 
+/** Layout of the pointer-free binary image of a B+ tree, written by
+ * btree::dump_image() and read by btree_image. Child and leaf links are
+ * stored as byte offsets from the start of the image instead of pointers, so
+ * the image can be used in place wherever it is mapped into memory. */
+template <typename _Key, typename _Data,
+          unsigned short _LeafSlots, unsigned short _InnerSlots,
+          bool _Duplicates, bool _UsedAsSet>
+struct btree_image_layout
+{
+    /// Byte offset of a node from the start of the image. Offset 0 is the
+    /// header, so it is used as the null link.
+    typedef unsigned long long  offset_type;
+
+    /// The header at the start of each image. Like the dump_header of the
+    /// btree the properties have to match the current template instantiation.
+    struct header
+    {
+        /// "stx-bimage", just to stop attach() from using garbage
+        char            signature[12];
+
+        /// Currently 0
+        unsigned short  version;
+
+        /// sizeof(key_type)
+        unsigned short  key_type_size;
+
+        /// sizeof(data_type)
+        unsigned short  data_type_size;
+
+        /// Number of slots in the leaves
+        unsigned short  leafslots;
+
+        /// Number of slots in the inner nodes
+        unsigned short  innerslots;
+
+        /// Allow duplicates
+        bool            allow_duplicates;
+
+        /// Data slots are omitted
+        bool            used_as_set;
+
+        /// The item count of the tree
+        offset_type     itemcount;
+
+        /// Number of leaves in the image
+        offset_type     leaves;
+
+        /// Number of inner nodes in the image
+        offset_type     innernodes;
+
+        /// Offset of the root node, either leaf or inner node
+        offset_type     root;
+
+        /// Offset of the first leaf in the double linked leaf chain
+        offset_type     headleaf;
+
+        /// Offset of the last leaf in the double linked leaf chain
+        offset_type     tailleaf;
+
+        /// Total size of the image in bytes
+        offset_type     size;
+
+        /// Fill the struct with the properties of the layout, the counts and
+        /// offsets are not filled.
+        inline void fill()
+        {
+            std::fill_n(reinterpret_cast<char*>(this), sizeof(*this), 0);
+
+            signature[0] = 's'; signature[1] = 't'; signature[2] = 'x'; signature[3] = '-';
+            signature[4] = 'b'; signature[5] = 'i'; signature[6] = 'm'; signature[7] = 'a';
+            signature[8] = 'g'; signature[9] = 'e'; signature[10] = 0; signature[11] = 0;
+
+            version = 0;
+            key_type_size = sizeof(_Key);
+            data_type_size = sizeof(_Data);
+            leafslots = _LeafSlots;
+            innerslots = _InnerSlots;
+            allow_duplicates = _Duplicates;
+            used_as_set = _UsedAsSet;
+        }
+
+        /// Returns true if the headers have the same vital properties
+        inline bool same(const header &o) const
+        {
+            return std::equal(signature, signature + 12, o.signature)
+                && (version == o.version)
+                && (key_type_size == o.key_type_size)
+                && (data_type_size == o.data_type_size)
+                && (leafslots == o.leafslots)
+                && (innerslots == o.innerslots)
+                && (allow_duplicates == o.allow_duplicates)
+                && (used_as_set == o.used_as_set);
+        }
+    };
+
+    /// The header of each node in the image.
+    struct node
+    {
+        /// Level in the b-tree, if level == 0 -> leaf node
+        unsigned short  level;
+
+        /// Number of key slotuse use, so number of valid children or data
+        /// pointers
+        unsigned short  slotuse;
+
+        /// True if this is a leaf node
+        inline bool isleafnode() const
+        {
+            return (level == 0);
+        }
+    };
+
+    /// Inner node in the image, children are offsets.
+    struct inner_node : public node
+    {
+        /// Keys of children or data pointers
+        _Key            slotkey[_InnerSlots];
+
+        /// Offsets of children
+        offset_type     childid[_InnerSlots+1];
+    };
+
+    /// Leaf node in the image, the leaf chain is kept as offsets.
+    struct leaf_node : public node
+    {
+        /// Offset of the previous leaf, 0 for the first one
+        offset_type     prevleaf;
+
+        /// Offset of the next leaf, 0 for the last one
+        offset_type     nextleaf;
+
+        /// Keys of children or data pointers
+        _Key            slotkey[_LeafSlots];
+
+        /// Array of data
+        _Data           slotdata[_UsedAsSet ? 1 : _LeafSlots];
+    };
+
+    /// Alignment of the node arrays in the image. The image itself has to
+    /// start at an address aligned to this.
+    static const size_t alignment = BTREE_MAX( BTREE_MAX(sizeof(offset_type), sizeof(_Key)), sizeof(_Data) );
+
+    /// Round an offset up to the node alignment.
+    static inline offset_type align(offset_type off)
+    {
+        return (off + alignment - 1) / alignment * alignment;
+    }
+};
+
+/** Vectorized intra-node search. The generic version is not available, so
+ * btree_node_search falls back to scalar code. Specializations for particular
+ * key types and comparisons set available and implement lower() and upper()
+ * with the same results as btree_node_search::linear_lower() and
+ * linear_upper(). */
+template <typename _Key, typename _Compare>
+struct btree_simd_search
+{
+    /// True if the specialization provides a vectorized kernel
+    static const bool available = false;
+
+    /// Number of slots of the first key greater or equal to key
+    static inline int lower(const _Key *, int, const _Key &)
+    {
+        return 0;
+    }
+
+    /// Number of slots of the first key greater than key
+    static inline int upper(const _Key *, int, const _Key &)
+    {
+        return 0;
+    }
+};
+
+/** Vectorized kernels for unsigned integer keys, selected by the size of the
+ * key. The keys of a node are sorted, so the slot searched for is the number
+ * of keys less than (lower) or less or equal to (upper) the key. These are
+ * counted one vector at a time by a compare and a popcount of the lane mask,
+ * until the first vector which is not counted entirely. There are only signed
+ * compares, so the sign bits of both sides are flipped. The generic version is
+ * not available. */
+template <typename _Key, size_t _Size = sizeof(_Key)>
+struct btree_simd_unsigned
+{
+    /// No kernel for this key size
+    static const bool available = false;
+
+    /// Number of slots of the first key greater or equal to key
+    static inline int lower(const _Key *, int, const _Key &)
+    {
+        return 0;
+    }
+
+    /// Number of slots of the first key greater than key
+    static inline int upper(const _Key *, int, const _Key &)
+    {
+        return 0;
+    }
+};
+
+#if defined(__SSE2__)
+
+/// Kernel for 32-bit unsigned keys, 8 keys per compare with AVX2 and 4 keys
+/// per compare with SSE2.
+template <typename _Key>
+struct btree_simd_unsigned<_Key, 4>
+{
+    /// Kernel is available with SSE2
+    static const bool available = true;
+
+    /// Number of slots of the first key greater or equal to key
+    static inline int lower(const _Key *keys, int n, const _Key &key)
+    {
+        return count<false>(keys, n, key);
+    }
+
+    /// Number of slots of the first key greater than key
+    static inline int upper(const _Key *keys, int n, const _Key &key)
+    {
+        return count<true>(keys, n, key);
+    }
+
+    /// Count the keys less than key, or less or equal to key if _Upper.
+    template <bool _Upper>
+    static inline int count(const _Key *keys, int n, const _Key &key)
+    {
+        int i = 0;
+
+#if defined(__AVX2__)
+        const __m256i sign8 = _mm256_set1_epi32(static_cast<int>(0x80000000u));
+        const __m256i key8 = _mm256_xor_si256(_mm256_set1_epi32(static_cast<int>(key)), sign8);
+
+        for (; i + 8 <= n; i += 8)
+        {
+            __m256i x = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i)), sign8);
+            int mask = _Upper
+                ? ~_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(x, key8))) & 0xFF
+                : _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(key8, x)));
+
+            if (mask != 0xFF) return i + __builtin_popcount(mask);
+        }
+#endif
+
+        const __m128i sign4 = _mm_set1_epi32(static_cast<int>(0x80000000u));
+        const __m128i key4 = _mm_xor_si128(_mm_set1_epi32(static_cast<int>(key)), sign4);
+
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128i x = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i)), sign4);
+            int mask = _Upper
+                ? ~_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(x, key4))) & 0xF
+                : _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(key4, x)));
+
+            if (mask != 0xF) return i + __builtin_popcount(mask);
+        }
+
+        for (; i < n; ++i)
+        {
+            if (_Upper ? (key < keys[i]) : !(keys[i] < key)) return i;
+        }
+
+        return n;
+    }
+};
+
+#endif // __SSE2__
+
+#if defined(__SSE4_2__)
+
+/// Kernel for 64-bit unsigned keys, 4 keys per compare with AVX2 and 2 keys
+/// per compare with SSE4.2, which brought the 64-bit compare.
+template <typename _Key>
+struct btree_simd_unsigned<_Key, 8>
+{
+    /// Kernel is available with SSE4.2
+    static const bool available = true;
+
+    /// Number of slots of the first key greater or equal to key
+    static inline int lower(const _Key *keys, int n, const _Key &key)
+    {
+        return count<false>(keys, n, key);
+    }
+
+    /// Number of slots of the first key greater than key
+    static inline int upper(const _Key *keys, int n, const _Key &key)
+    {
+        return count<true>(keys, n, key);
+    }
+
+    /// Count the keys less than key, or less or equal to key if _Upper.
+    template <bool _Upper>
+    static inline int count(const _Key *keys, int n, const _Key &key)
+    {
+        int i = 0;
+
+#if defined(__AVX2__)
+        const __m256i sign4 = _mm256_set1_epi64x(static_cast<long long>(0x8000000000000000ull));
+        const __m256i key4 = _mm256_xor_si256(_mm256_set1_epi64x(static_cast<long long>(key)), sign4);
+
+        for (; i + 4 <= n; i += 4)
+        {
+            __m256i x = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i)), sign4);
+            int mask = _Upper
+                ? ~_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(x, key4))) & 0xF
+                : _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(key4, x)));
+
+            if (mask != 0xF) return i + __builtin_popcount(mask);
+        }
+#endif
+
+        const __m128i sign2 = _mm_set1_epi64x(static_cast<long long>(0x8000000000000000ull));
+        const __m128i key2 = _mm_xor_si128(_mm_set1_epi64x(static_cast<long long>(key)), sign2);
+
+        for (; i + 2 <= n; i += 2)
+        {
+            __m128i x = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i)), sign2);
+            int mask = _Upper
+                ? ~_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(x, key2))) & 0x3
+                : _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(key2, x)));
+
+            if (mask != 0x3) return i + __builtin_popcount(mask);
+        }
+
+        for (; i < n; ++i)
+        {
+            if (_Upper ? (key < keys[i]) : !(keys[i] < key)) return i;
+        }
+
+        return n;
+    }
+};
+
+#endif // __SSE4_2__
+
+// BTREE_NO_SIMD keeps the kernels off, the nodes are then searched by
+// the linear or binary search picked by binsearch_threshold.
+#ifndef BTREE_NO_SIMD
+
+/// Vectorized search for unsigned int keys sorted by std::less.
+template <>
+struct btree_simd_search< unsigned int, std::less<unsigned int> >
+    : public btree_simd_unsigned<unsigned int>
+{ };
+
+/// Vectorized search for unsigned long keys sorted by std::less.
+template <>
+struct btree_simd_search< unsigned long, std::less<unsigned long> >
+    : public btree_simd_unsigned<unsigned long>
+{ };
+
+/// Vectorized search for unsigned long long keys sorted by std::less.
+template <>
+struct btree_simd_search< unsigned long long, std::less<unsigned long long> >
+    : public btree_simd_unsigned<unsigned long long>
+{ };
+
+#endif // BTREE_NO_SIMD
+
+/** Intra-node search used by the find_lower() and find_upper() functions of
+ * btree and btree_image. The strategy is picked at compile time from the size
+ * of the node's key array: a vectorized kernel if btree_simd_search has one
+ * for the key type, a linear scan for nodes up to binsearch_threshold bytes
+ * and a branchless binary search for larger nodes. */
+template <typename _Key, typename _Compare, size_t _Threshold>
+struct btree_node_search
+{
+    /// Type of the vectorized kernel
+    typedef btree_simd_search<_Key, _Compare>   simd_search;
+
+    /// Searches for the first of the n keys greater or equal to key.
+    template <size_t _KeyArraySize>
+    static inline int lower(const _Key *keys, int n, const _Key &key, const _Compare &less)
+    {
+        if (simd_search::available)
+            return simd_search::lower(keys, n, key);
+        else if (_KeyArraySize > _Threshold)
+            return binary_lower(keys, n, key, less);
+        else
+            return linear_lower(keys, n, key, less);
+    }
+
+    /// Searches for the first of the n keys greater than key.
+    template <size_t _KeyArraySize>
+    static inline int upper(const _Key *keys, int n, const _Key &key, const _Compare &less)
+    {
+        if (simd_search::available)
+            return simd_search::upper(keys, n, key);
+        else if (_KeyArraySize > _Threshold)
+            return binary_upper(keys, n, key, less);
+        else
+            return linear_upper(keys, n, key, less);
+    }
+
+    /// Number of keys compared by a search of n keys which ended at slot lo,
+    /// for the instrumentation counters. The scans stop at the result, the
+    /// vectorized kernel is counted like a linear scan.
+    template <size_t _KeyArraySize>
+    static inline int compares(int n, int lo)
+    {
+        if (!simd_search::available && _KeyArraySize > _Threshold)
+        {
+            int steps = (n > 0) ? 1 : 0;
+            while (n > 1)
+            {
+                n -= n >> 1;
+                ++steps;
+            }
+            return steps;
+        }
+        else
+            return (lo < n) ? lo + 1 : n;
+    }
+
+    /// Linear scan for the first key greater or equal to key.
+    static inline int linear_lower(const _Key *keys, int n, const _Key &key, const _Compare &less)
+    {
+        int lo = 0;
+        while (lo < n && less(keys[lo], key)) ++lo;
+        return lo;
+    }
+
+    /// Linear scan for the first key greater than key.
+    static inline int linear_upper(const _Key *keys, int n, const _Key &key, const _Compare &less)
+    {
+        int lo = 0;
+        while (lo < n && !less(key, keys[lo])) ++lo;
+        return lo;
+    }
+
+    /// Binary search for the first key greater or equal to key. The range is
+    /// halved by a conditional move instead of a branch, so the number of
+    /// steps only depends on n and there are no mispredictions.
+    static inline int binary_lower(const _Key *keys, int n, const _Key &key, const _Compare &less)
+    {
+        if (n == 0) return 0;
+
+        const _Key *base = keys;
+        while (n > 1)
+        {
+            int half = n >> 1;
+            base = less(base[half], key) ? base + half : base;
+            n -= half;
+        }
+
+        return static_cast<int>(base - keys) + (less(*base, key) ? 1 : 0);
+    }
+
+    /// Binary search for the first key greater than key, see binary_lower().
+    static inline int binary_upper(const _Key *keys, int n, const _Key &key, const _Compare &less)
+    {
+        if (n == 0) return 0;
+
+        const _Key *base = keys;
+        while (n > 1)
+        {
+            int half = n >> 1;
+            base = !less(key, base[half]) ? base + half : base;
+            n -= half;
+        }
+
+        return static_cast<int>(base - keys) + (!less(key, *base) ? 1 : 0);
+    }
+};
+
+/** Hook for node allocators which can return all their memory at once. It is
+ * called by btree::clear() after all nodes were freed. The generic version
+ * does nothing. */
+template <typename _Alloc>
+struct btree_allocator_release
+{
+    /// Release all memory held by the allocator
+    static inline void release(_Alloc &)
+    { }
+};
+
 /** @brief Basic class implementing a base B+ tree data structure in memory.
  *
  * The base implementation of a memory B+ tree. It is based on the
@@ -1245,7 +1758,9 @@ public:
     // *** Small Statistics Structure
 
     /** A small struct containing basic statistics about the B+ tree. It can be
-     * fetched using get_stats(). */
+     * fetched using get_stats(). The instrumentation counters are plain
+     * mutable members which even const lookups write to, so they are only
+     * exact while the tree is used by one thread at a time. */
     struct tree_stats
     {
         /// Number of items in the B+ tree
@@ -1257,6 +1772,48 @@ public:
         /// Number of inner nodes in the B+ tree
         size_type       innernodes;
 
+#ifdef BTREE_INSTRUMENT
+        /// Number of walks starting from the root, by lookups, inserts and
+        /// erases alike. Inserts next to a valid hint don't descend.
+        mutable size_type   descents;
+
+        /// Number of nodes searched by the descents.
+        mutable size_type   nodes_visited;
+
+        /// Number of keys compared by the intra-node searches.
+        mutable size_type   key_compares;
+
+        /// Number of leaves split by inserts.
+        mutable size_type   leaf_splits;
+
+        /// Number of inner nodes split by inserts.
+        mutable size_type   inner_splits;
+
+        /// Number of leaves merged into their sibling by erases.
+        mutable size_type   leaf_merges;
+
+        /// Number of inner nodes merged into their sibling by erases.
+        mutable size_type   inner_merges;
+
+        /// Number of leaf pairs balanced by shifting items by erases.
+        mutable size_type   leaf_shifts;
+
+        /// Number of inner node pairs balanced by shifting items by erases.
+        mutable size_type   inner_shifts;
+
+        /// Number of bulk_load() calls.
+        mutable size_type   bulk_loads;
+
+        /// Number of leaves filled by bulk_load().
+        mutable size_type   bulk_load_leaves;
+
+        /// Number of inner nodes built by bulk_load(), level by level.
+        mutable size_type   bulk_load_innernodes;
+
+        /// Number of inner levels built by bulk_load().
+        mutable size_type   bulk_load_levels;
+#endif
+
         /// Base B+ tree parameter: The number of key/data slots in each leaf
         static const unsigned short     leafslots = btree_self::leafslotmax;
 
@@ -1268,7 +1825,37 @@ public:
             : itemcount(0),
               leaves(0), innernodes(0)
         {
+#ifdef BTREE_INSTRUMENT
+            reset_counters();
+#endif
+        }
+
+#ifdef BTREE_INSTRUMENT
+        /// Zero the instrumentation counters, the sizes are kept. The
+        /// counters are mutable so they can be reset through get_stats().
+        inline void reset_counters() const
+        {
+            descents = nodes_visited = key_compares = 0;
+            leaf_splits = inner_splits = 0;
+            leaf_merges = inner_merges = 0;
+            leaf_shifts = inner_shifts = 0;
+            bulk_loads = bulk_load_leaves = 0;
+            bulk_load_innernodes = bulk_load_levels = 0;
+        }
+
+        /// Return the average number of nodes searched per descent, the
+        /// height of the tree if it was not changed.
+        inline double avgnodes_descent() const
+        {
+            return descents ? static_cast<double>(nodes_visited) / descents : 0.0;
+        }
+
+        /// Return the average number of keys compared per node searched
+        inline double avgcompares_node() const
+        {
+            return nodes_visited ? static_cast<double>(key_compares) / nodes_visited : 0.0;
         }
+#endif
 
         /// Return the total number of nodes
         inline size_type nodes() const
@@ -1535,6 +2122,8 @@ public:
             m_headleaf = m_tailleaf = NULL;
 
             m_stats = tree_stats();
+
+            btree_allocator_release<allocator_type>::release(m_allocator);
         }
 
         BTREE_ASSERT(m_stats.itemcount == 0);
@@ -1627,98 +2216,53 @@ public:
 private:
     // *** B+ Tree Node Binary Search Functions
 
+    /// Intra-node search strategy, selected by the size of the key arrays.
+    typedef btree_node_search<key_type, key_compare, traits::binsearch_threshold> node_search;
+
     /// Searches for the first key in the node n greater or equal to key. Uses
-    /// binary search with an optional linear self-verification. This is a
-    /// template function, because the slotkey array is located at different
-    /// places in leaf_node and inner_node.
+    /// the strategy of btree_node_search with an optional linear
+    /// self-verification. This is a template function, because the slotkey
+    /// array is located at different places in leaf_node and inner_node.
     template <typename node_type>
     inline int find_lower(const node_type *n, const key_type& key) const
     {
-        if ( 0 && sizeof(n->slotkey) > traits::binsearch_threshold )
-        {
-            if (n->slotuse == 0) return 0;
+        int lo = node_search::template lower<sizeof(n->slotkey)>(n->slotkey, n->slotuse, key, m_key_less);
 
-            int lo = 0, hi = n->slotuse;
+        BTREE_PRINT("btree::find_lower: on " << n << " key " << key << " -> " << lo);
 
-            while (lo < hi)
-            {
-                int mid = (lo + hi) >> 1;
+        BTREE_COUNT(nodes_visited, 1);
+        BTREE_COUNT(key_compares, node_search::template compares<sizeof(n->slotkey)>(n->slotuse, lo));
 
-                if (key_lessequal(key, n->slotkey[mid])) {
-                    hi = mid; // key <= mid
-                }
-                else {
-                    lo = mid + 1; // key > mid
-                }
-            }
-
-            BTREE_PRINT("btree::find_lower: on " << n << " key " << key << " -> " << lo << " / " << hi);
-
-            // verify result using simple linear search
-            if (selfverify)
-            {
-                int i = 0;
-                while (i < n->slotuse && key_less(n->slotkey[i],key)) ++i;
-
-                BTREE_PRINT("btree::find_lower: testfind: " << i);
-                BTREE_ASSERT(i == lo);
-            }
-
-            return lo;
-        }
-        else // for nodes <= binsearch_threshold do linear search.
+        // verify result using simple linear search
+        if (selfverify)
         {
-            int lo = 0;
-            while (lo < n->slotuse && key_less(n->slotkey[lo],key)) ++lo;
-            return lo;
+            BTREE_ASSERT(node_search::linear_lower(n->slotkey, n->slotuse, key, m_key_less) == lo);
         }
+
+        return lo;
     }
 
-    /// Searches for the first key in the node n greater than key. Uses binary
-    /// search with an optional linear self-verification. This is a template
-    /// function, because the slotkey array is located at different places in
-    /// leaf_node and inner_node.
+    /// Searches for the first key in the node n greater than key. Uses the
+    /// strategy of btree_node_search with an optional linear
+    /// self-verification. This is a template function, because the slotkey
+    /// array is located at different places in leaf_node and inner_node.
     template <typename node_type>
     inline int find_upper(const node_type *n, const key_type& key) const
     {
-        if ( 0 && sizeof(n->slotkey) > traits::binsearch_threshold )
-        {
-            if (n->slotuse == 0) return 0;
+        int lo = node_search::template upper<sizeof(n->slotkey)>(n->slotkey, n->slotuse, key, m_key_less);
 
-            int lo = 0, hi = n->slotuse;
+        BTREE_PRINT("btree::find_upper: on " << n << " key " << key << " -> " << lo);
 
-            while (lo < hi)
-            {
-                int mid = (lo + hi) >> 1;
+        BTREE_COUNT(nodes_visited, 1);
+        BTREE_COUNT(key_compares, node_search::template compares<sizeof(n->slotkey)>(n->slotuse, lo));
 
-                if (key_less(key, n->slotkey[mid])) {
-                    hi = mid; // key < mid
-                }
-                else {
-                    lo = mid + 1; // key >= mid
-                }
-            }
-
-            BTREE_PRINT("btree::find_upper: on " << n << " key " << key << " -> " << lo << " / " << hi);
-
-            // verify result using simple linear search
-            if (selfverify)
-            {
-                int i = 0;
-                while (i < n->slotuse && key_lessequal(n->slotkey[i],key)) ++i;
-
-                BTREE_PRINT("btree::find_upper testfind: " << i);
-                BTREE_ASSERT(i == hi);
-            }
-
-            return lo;
-        }
-        else // for nodes <= binsearch_threshold do linear search.
+        // verify result using simple linear search
+        if (selfverify)
         {
-            int lo = 0;
-            while (lo < n->slotuse && key_lessequal(n->slotkey[lo],key)) ++lo;
-            return lo;
+            BTREE_ASSERT(node_search::linear_upper(n->slotkey, n->slotuse, key, m_key_less) == lo);
         }
+
+        return lo;
     }
 
 public:
@@ -1759,6 +2303,8 @@ public:
         const node *n = m_root;
         if (!n) return false;
 
+        BTREE_COUNT(descents, 1);
+
         while(!n->isleafnode())
         {
             const inner_node *inner = static_cast<const inner_node*>(n);
@@ -1780,6 +2326,8 @@ public:
         node *n = m_root;
         if (!n) return end();
 
+        BTREE_COUNT(descents, 1);
+
         while(!n->isleafnode())
         {
             const inner_node *inner = static_cast<const inner_node*>(n);
@@ -1802,6 +2350,8 @@ public:
         const node *n = m_root;
         if (!n) return end();
 
+        BTREE_COUNT(descents, 1);
+
         while(!n->isleafnode())
         {
             const inner_node *inner = static_cast<const inner_node*>(n);
@@ -1824,6 +2374,8 @@ public:
         const node *n = m_root;
         if (!n) return 0;
 
+        BTREE_COUNT(descents, 1);
+
         while(!n->isleafnode())
         {
             const inner_node *inner = static_cast<const inner_node*>(n);
@@ -1857,6 +2409,8 @@ public:
         node *n = m_root;
         if (!n) return end();
 
+        BTREE_COUNT(descents, 1);
+
         while(!n->isleafnode())
         {
             const inner_node *inner = static_cast<const inner_node*>(n);
@@ -1879,6 +2433,8 @@ public:
         const node *n = m_root;
         if (!n) return end();
 
+        BTREE_COUNT(descents, 1);
+
         while(!n->isleafnode())
         {
             const inner_node *inner = static_cast<const inner_node*>(n);
@@ -1900,6 +2456,8 @@ public:
         node *n = m_root;
         if (!n) return end();
 
+        BTREE_COUNT(descents, 1);
+
         while(!n->isleafnode())
         {
             const inner_node *inner = static_cast<const inner_node*>(n);
@@ -1922,6 +2480,8 @@ public:
         const node *n = m_root;
         if (!n) return end();
 
+        BTREE_COUNT(descents, 1);
+
         while(!n->isleafnode())
         {
             const inner_node *inner = static_cast<const inner_node*>(n);
@@ -1948,6 +2508,170 @@ public:
         return std::pair<const_iterator, const_iterator>(lower_bound(key), upper_bound(key));
     }
 
+private:
+    // *** Batched Descent of Many Keys
+
+    /// Prefetch the cache lines of node n up to the end of its keys, which
+    /// covers the header and everything the intra-node search reads.
+    template <typename node_type>
+    static inline void prefetch_keys(const node_type *n)
+    {
+        const char *line = reinterpret_cast<const char*>(n);
+        const char *end = reinterpret_cast<const char*>(n->slotkey + sizeof(n->slotkey) / sizeof(key_type));
+
+        for (; line < end; line += 64)
+            BTREE_PREFETCH(line);
+    }
+
+    /// Descend with the n keys at keys[] from the root to their leaves in
+    /// lock-step, one level at a time. The child of every lookup is
+    /// prefetched right when it is found, so by the time a lookup searches
+    /// it the other lookups of the group have hidden most of its cache
+    /// misses. Writes the leaf and the slot of find_lower() or find_upper().
+    template <bool _Upper, typename ForwardIterator>
+    void multi_descend(const ForwardIterator *keys, int n, const leaf_node **leaf, unsigned short *slot) const
+    {
+        const node *cur[BTREE_BATCH_GROUP];
+
+        if (!m_root)
+        {
+            for (int i = 0; i < n; ++i)
+            {
+                leaf[i] = NULL;
+                slot[i] = 0;
+            }
+            return;
+        }
+
+        for (int i = 0; i < n; ++i)
+            cur[i] = m_root;
+
+        BTREE_COUNT(descents, n);
+
+        for (unsigned short level = m_root->level; level > 0; --level)
+        {
+            for (int i = 0; i < n; ++i)
+            {
+                const inner_node *inner = static_cast<const inner_node*>(cur[i]);
+                int s = _Upper ? find_upper(inner, *keys[i]) : find_lower(inner, *keys[i]);
+
+                cur[i] = inner->childid[s];
+
+                if (level > 1)
+                    prefetch_keys(static_cast<const inner_node*>(cur[i]));
+                else
+                    prefetch_keys(static_cast<const leaf_node*>(cur[i]));
+            }
+        }
+
+        for (int i = 0; i < n; ++i)
+        {
+            leaf[i] = static_cast<const leaf_node*>(cur[i]);
+            slot[i] = _Upper ? find_upper(leaf[i], *keys[i]) : find_lower(leaf[i], *keys[i]);
+
+            // a separator left behind by erase() can end the search behind
+            // the last slot, the bound is the first slot of the next leaf.
+            if (slot[i] == leaf[i]->slotuse && leaf[i]->nextleaf)
+            {
+                leaf[i] = leaf[i]->nextleaf;
+                slot[i] = 0;
+            }
+        }
+    }
+
+    /// Run multi_descend() over [kbegin, kend) in groups and write the
+    /// lower_bound() of every key to out.
+    template <typename _Iterator, typename ForwardIterator, typename OutputIterator>
+    OutputIterator multi_bound(ForwardIterator kbegin, ForwardIterator kend, OutputIterator out) const
+    {
+        ForwardIterator keys[BTREE_BATCH_GROUP];
+        const leaf_node *leaf[BTREE_BATCH_GROUP];
+        unsigned short slot[BTREE_BATCH_GROUP];
+
+        while (kbegin != kend)
+        {
+            int n = 0;
+            for (; n < BTREE_BATCH_GROUP && kbegin != kend; ++n, ++kbegin)
+                keys[n] = kbegin;
+
+            multi_descend<false>(keys, n, leaf, slot);
+
+            for (int i = 0; i < n; ++i)
+                *out++ = _Iterator(const_cast<leaf_node*>(leaf[i]), slot[i]);
+        }
+
+        return out;
+    }
+
+    /// Run multi_descend() over [kbegin, kend) in groups, once for the lower
+    /// and once for the upper bounds, and write the equal_range() of every
+    /// key to out.
+    template <typename _Iterator, typename ForwardIterator, typename OutputIterator>
+    OutputIterator multi_range(ForwardIterator kbegin, ForwardIterator kend, OutputIterator out) const
+    {
+        ForwardIterator keys[BTREE_BATCH_GROUP];
+        const leaf_node *lowerleaf[BTREE_BATCH_GROUP], *upperleaf[BTREE_BATCH_GROUP];
+        unsigned short lowerslot[BTREE_BATCH_GROUP], upperslot[BTREE_BATCH_GROUP];
+
+        while (kbegin != kend)
+        {
+            int n = 0;
+            for (; n < BTREE_BATCH_GROUP && kbegin != kend; ++n, ++kbegin)
+                keys[n] = kbegin;
+
+            multi_descend<false>(keys, n, lowerleaf, lowerslot);
+            multi_descend<true>(keys, n, upperleaf, upperslot);
+
+            for (int i = 0; i < n; ++i)
+            {
+                *out++ = std::make_pair(_Iterator(const_cast<leaf_node*>(lowerleaf[i]), lowerslot[i]),
+                                        _Iterator(const_cast<leaf_node*>(upperleaf[i]), upperslot[i]));
+            }
+        }
+
+        return out;
+    }
+
+public:
+    // *** Batched Access Functions Descending for Many Keys at Once
+
+    /// Writes lower_bound() of every key in [kbegin, kend) to out, in the
+    /// order of the keys. Groups of BTREE_BATCH_GROUP lookups descend the
+    /// tree together with prefetching, which is several times the throughput
+    /// of single lookups on a tree that does not fit into the cache. Returns
+    /// the end of the output.
+    template <typename ForwardIterator, typename OutputIterator>
+    OutputIterator multi_lower_bound(ForwardIterator kbegin, ForwardIterator kend, OutputIterator out)
+    {
+        return multi_bound<iterator>(kbegin, kend, out);
+    }
+
+    /// Writes lower_bound() of every key in [kbegin, kend) to out as constant
+    /// iterators, see the non-const multi_lower_bound().
+    template <typename ForwardIterator, typename OutputIterator>
+    OutputIterator multi_lower_bound(ForwardIterator kbegin, ForwardIterator kend, OutputIterator out) const
+    {
+        return multi_bound<const_iterator>(kbegin, kend, out);
+    }
+
+    /// Writes equal_range() of every key in [kbegin, kend) to out as pairs of
+    /// iterators, in the order of the keys. The lower and the upper bounds of
+    /// a group are searched by a batched descent each. Returns the end of the
+    /// output.
+    template <typename ForwardIterator, typename OutputIterator>
+    OutputIterator multi_equal_range(ForwardIterator kbegin, ForwardIterator kend, OutputIterator out)
+    {
+        return multi_range<iterator>(kbegin, kend, out);
+    }
+
+    /// Writes equal_range() of every key in [kbegin, kend) to out as pairs of
+    /// constant iterators, see the non-const multi_equal_range().
+    template <typename ForwardIterator, typename OutputIterator>
+    OutputIterator multi_equal_range(ForwardIterator kbegin, ForwardIterator kend, OutputIterator out) const
+    {
+        return multi_range<const_iterator>(kbegin, kend, out);
+    }
+
 public:
     // *** B+ Tree Object Comparison Functions
 
@@ -2108,18 +2832,20 @@ public:
         return insert_start(key, data);
     }
 
-    /// Attempt to insert a key/data pair into the B+ tree. The iterator hint
-    /// is currently ignored by the B+ tree insertion routine.
-    inline iterator insert(iterator /* hint */, const pair_type &x)
+    /// Attempt to insert a key/data pair into the B+ tree. If the key belongs
+    /// into the hint's leaf or the last leaf and that has a free slot, the
+    /// pair is put there without descending from the root.
+    inline iterator insert(iterator hint, const pair_type &x)
     {
-        return insert_start(x.first, x.second).first;
+        return insert_hint_start(hint.currnode, x.first, x.second).first;
     }
 
-    /// Attempt to insert a key/data pair into the B+ tree. The iterator hint is
-    /// currently ignored by the B+ tree insertion routine.
-    inline iterator insert2(iterator /* hint */, const key_type& key, const data_type& data)
+    /// Attempt to insert a key/data pair into the B+ tree. If the key belongs
+    /// into the hint's leaf or the last leaf and that has a free slot, the
+    /// pair is put there without descending from the root.
+    inline iterator insert2(iterator hint, const key_type& key, const data_type& data)
     {
-        return insert_start(key, data).first;
+        return insert_hint_start(hint.currnode, key, data).first;
     }
 
     /// Attempt to insert the range [first,last) of value_type pairs into the
@@ -2150,6 +2876,7 @@ private:
             m_root = m_headleaf = m_tailleaf = allocate_leaf();
         }
 
+        BTREE_COUNT(descents, 1);
         std::pair<iterator, bool> r = insert_descend(m_root, key, value, &newkey, &newchild);
 
         if (newchild)
@@ -2180,6 +2907,72 @@ private:
         return r;
     }
 
+    /// Insert into the hinted leaf or the last leaf if the key belongs there,
+    /// falling back to insert_start() otherwise. Returns true if the item was
+    /// inserted.
+    std::pair<iterator, bool> insert_hint_start(leaf_node* hint, const key_type& key, const data_type& value)
+    {
+        leaf_node *leaf = NULL;
+
+        if (hint && insert_hint_fits(hint, key))
+            leaf = hint;
+        else if (m_tailleaf && m_tailleaf != hint && insert_hint_fits(m_tailleaf, key))
+            leaf = m_tailleaf;
+        else
+            return insert_start(key, value);
+
+        int slot = find_lower(leaf, key);
+
+        if (!allow_duplicates && slot < leaf->slotuse && key_equal(key, leaf->slotkey[slot])) {
+            return std::pair<iterator, bool>(iterator(leaf, slot), false);
+        }
+
+        std::copy_backward(leaf->slotkey + slot, leaf->slotkey + leaf->slotuse,
+                           leaf->slotkey + leaf->slotuse+1);
+        data_copy_backward(leaf->slotdata + slot, leaf->slotdata + leaf->slotuse,
+                           leaf->slotdata + leaf->slotuse+1);
+
+        leaf->slotkey[slot] = key;
+        if (!used_as_set) leaf->slotdata[slot] = value;
+        leaf->slotuse++;
+
+        ++m_stats.itemcount;
+
+#ifdef BTREE_DEBUG
+        if (debug) print(std::cout);
+#endif
+
+        if (selfverify) {
+            verify();
+            BTREE_ASSERT(exists(key));
+        }
+
+        return std::pair<iterator, bool>(iterator(leaf, slot), true);
+    }
+
+    /// Test if key can be put into the leaf without touching its parents: the
+    /// leaf must have a free slot, the key must not be before the previous
+    /// leaf's keys, and not after the leaf's last key unless it is the last
+    /// leaf, whose last key is kept by no separator.
+    bool insert_hint_fits(const leaf_node* leaf, const key_type& key) const
+    {
+        if (leaf->isfull()) return false;
+
+        if (leaf->prevleaf)
+        {
+            const leaf_node *prev = leaf->prevleaf;
+            const key_type &prevkey = prev->slotkey[prev->slotuse - 1];
+
+            if (allow_duplicates ? key_less(key, prevkey) : key_lessequal(key, prevkey))
+                return false;
+        }
+
+        if (leaf->nextleaf && key_less(leaf->slotkey[leaf->slotuse - 1], key))
+            return false;
+
+        return true;
+    }
+
     /**
      * @brief Insert an item into the B+ tree.
      *
@@ -2329,6 +3122,8 @@ private:
 
         BTREE_PRINT("btree::split_leaf_node on " << leaf);
 
+        BTREE_COUNT(leaf_splits, 1);
+
         leaf_node *newleaf = allocate_leaf();
 
         newleaf->slotuse = leaf->slotuse - mid;
@@ -2376,6 +3171,8 @@ private:
 
         BTREE_PRINT("btree::split_inner_node on " << inner << " into two nodes " << mid << " and " << inner->slotuse - (mid + 1) << " sized");
 
+        BTREE_COUNT(inner_splits, 1);
+
         inner_node *newinner = allocate_inner(inner->level);
 
         newinner->slotuse = inner->slotuse - (mid + 1);
@@ -2403,6 +3200,7 @@ public:
         BTREE_ASSERT(empty());
 
         m_stats.itemcount = iend - ibegin;
+        BTREE_COUNT(bulk_loads, 1);
 
         // calculate number of leaves needed, round up.
         size_t num_items = iend - ibegin;
@@ -2435,6 +3233,7 @@ public:
         }
 
         BTREE_ASSERT( it == iend && num_items == 0 );
+        BTREE_COUNT(bulk_load_leaves, num_leaves);
 
         // if the btree is so small to fit into one leaf, then we're done.
         if (m_headleaf == m_tailleaf) {
@@ -2481,6 +3280,8 @@ public:
         }
 
         BTREE_ASSERT( leaf == NULL && num_leaves == 0 );
+        BTREE_COUNT(bulk_load_innernodes, num_parents);
+        BTREE_COUNT(bulk_load_levels, 1);
 
         // recursively build inner nodes pointing to inner nodes.
         for (int level = 2; num_parents != 1; ++level)
@@ -2519,6 +3320,8 @@ public:
             }
 
             BTREE_ASSERT( num_children == 0 );
+            BTREE_COUNT(bulk_load_innernodes, num_parents);
+            BTREE_COUNT(bulk_load_levels, 1);
         }
 
         m_root = nextlevel[0].first;
@@ -2527,6 +3330,357 @@ public:
         if (selfverify) verify();
     }
 
+    // *** Sorted Batch Insertion - Merge a Sorted Sequence into the Tree
+
+    /// Insert a sorted range into the tree, which may already hold items.
+    /// Unlike insert(first,last), the range is merged into the leaves from
+    /// left to right, each visited node at most once, with splits applied
+    /// bottom-up as the leaves and inner nodes overflow. Items are placed
+    /// after equal keys already in the tree. The iterators must be random
+    /// access, as for bulk_load().
+    template <typename Iterator>
+    void insert_sorted(Iterator ibegin, Iterator iend)
+    {
+        BTREE_PRINT("btree::insert_sorted of " << (iend - ibegin) << " items on btree size " << size());
+
+        if (ibegin == iend) return;
+
+        if (selfverify)
+        {
+            for (Iterator it = ibegin + 1; it != iend; ++it)
+                BTREE_ASSERT(!key_less(value_key(*it), value_key(*(it - 1))));
+        }
+
+        // bulk_load() does not drop equal keys
+        if (!m_root && allow_duplicates) {
+            bulk_load(ibegin, iend);
+            return;
+        }
+
+        if (!m_root) {
+            m_root = m_headleaf = m_tailleaf = allocate_leaf();
+        }
+
+        insert_sorted_splits splits;
+        size_type inserted = 0;
+
+        BTREE_COUNT(descents, 1);
+        insert_sorted_descend(m_root, ibegin, iend, splits, inserted);
+
+        // grow the tree by as many levels as the root's splits need
+        while (!splits.empty())
+        {
+            std::vector<key_type> keys;
+            std::vector<node*> children(1, m_root);
+
+            for (typename insert_sorted_splits::const_iterator it = splits.begin(); it != splits.end(); ++it)
+            {
+                keys.push_back(it->first);
+                children.push_back(it->second);
+            }
+
+            inner_node *newroot = allocate_inner(m_root->level + 1);
+            m_root = newroot;
+
+            splits.clear();
+            insert_sorted_inner(newroot, keys, children, splits);
+        }
+
+        m_stats.itemcount += inserted;
+
+#ifdef BTREE_DEBUG
+        if (debug) print(std::cout);
+#endif
+        if (selfverify) verify();
+    }
+
+private:
+    /// Nodes split off a node by insert_sorted(), in order, each with the
+    /// largest key of the node before it.
+    typedef std::vector< std::pair<key_type, node*> > insert_sorted_splits;
+
+    /// Key of a key/data pair of a sorted range. Overloaded function used by
+    /// insert_sorted().
+    static inline const key_type& value_key(const pair_type& value)
+    {
+        return value.first;
+    }
+
+    /// Key of a key of a sorted range. Overloaded function used by
+    /// insert_sorted().
+    static inline const key_type& value_key(const key_type& key)
+    {
+        return key;
+    }
+
+    /// Test if an item with key is routed to the child left of the separator
+    /// sepkey. Equal keys go right with duplicates, so that items are placed
+    /// after the present ones, and left without, where the present key is.
+    inline bool insert_sorted_left(const key_type& key, const key_type& sepkey) const
+    {
+        return allow_duplicates ? key_less(key, sepkey) : key_lessequal(key, sepkey);
+    }
+
+    /// Return the first item of the sorted range [first,last) which is not
+    /// routed to the child left of the separator sepkey.
+    template <typename Iterator>
+    Iterator insert_sorted_route(Iterator first, Iterator last, const key_type& sepkey) const
+    {
+        size_t count = last - first;
+
+        while (count > 0)
+        {
+            size_t step = count / 2;
+            Iterator mid = first + step;
+
+            if (insert_sorted_left(value_key(*mid), sepkey)) {
+                first = mid + 1;
+                count -= step + 1;
+            }
+            else {
+                count = step;
+            }
+        }
+
+        return first;
+    }
+
+    /**
+     * @brief Merge the sorted range [first,last) into the subtree of n.
+     *
+     * The items are routed to the children by insert_sorted_left(), children
+     * without items are not visited. If children were split,
+     * the node's children are collected and laid out again over as many
+     * inner nodes as needed. Nodes split off n are appended to splits.
+     */
+    template <typename Iterator>
+    void insert_sorted_descend(node *n, Iterator first, Iterator last,
+                               insert_sorted_splits &splits, size_type &inserted)
+    {
+        if (n->isleafnode())
+        {
+            insert_sorted_leaf(static_cast<leaf_node*>(n), first, last, splits, inserted);
+            return;
+        }
+
+        inner_node *inner = static_cast<inner_node*>(n);
+
+        BTREE_COUNT(nodes_visited, 1);
+
+        // children and keys of the node, collected after the first split
+        bool collect = false;
+        std::vector<key_type> keys;
+        std::vector<node*> children;
+        insert_sorted_splits childsplits;
+
+        for (unsigned short slot = 0; slot <= inner->slotuse; ++slot)
+        {
+            if (first == last && !collect) break;
+
+            childsplits.clear();
+
+            // skip children whose keys are all before the next item
+            if (first != last &&
+                (slot == inner->slotuse || insert_sorted_left(value_key(*first), inner->slotkey[slot])))
+            {
+                Iterator end = (slot < inner->slotuse) ? insert_sorted_route(first, last, inner->slotkey[slot]) : last;
+
+                insert_sorted_descend(inner->childid[slot], first, end, childsplits, inserted);
+                first = end;
+            }
+
+            if (!childsplits.empty() && !collect)
+            {
+                collect = true;
+                keys.assign(inner->slotkey, inner->slotkey + slot);
+                children.assign(inner->childid, inner->childid + slot);
+            }
+
+            if (collect)
+            {
+                children.push_back(inner->childid[slot]);
+
+                for (typename insert_sorted_splits::const_iterator it = childsplits.begin(); it != childsplits.end(); ++it)
+                {
+                    keys.push_back(it->first);
+                    children.push_back(it->second);
+                }
+
+                if (slot < inner->slotuse)
+                    keys.push_back(inner->slotkey[slot]);
+            }
+        }
+
+        BTREE_ASSERT(first == last);
+
+        if (collect)
+            insert_sorted_inner(inner, keys, children, splits);
+    }
+
+    /// Lay out the children and keys over n and as many new inner nodes of
+    /// its level as needed, filled evenly like bulk_load() does. The new nodes
+    /// are appended to splits.
+    void insert_sorted_inner(inner_node *n, const std::vector<key_type> &keys,
+                             const std::vector<node*> &children, insert_sorted_splits &splits)
+    {
+        BTREE_ASSERT(keys.size() + 1 == children.size());
+
+        size_t num_children = children.size();
+        size_t num_nodes = (num_children + innerslotmax) / (innerslotmax + 1);
+
+        BTREE_COUNT(inner_splits, num_nodes - 1);
+
+        inner_node *curr = n;
+        size_t child = 0;
+
+        for (size_t i = 0; i < num_nodes; ++i)
+        {
+            if (i > 0) {
+                curr = allocate_inner(n->level);
+                splits.push_back(std::make_pair(keys[child - 1], static_cast<node*>(curr)));
+            }
+
+            size_t num = num_children / (num_nodes - i);
+
+            std::copy(keys.begin() + child, keys.begin() + child + num - 1, curr->slotkey);
+            std::copy(children.begin() + child, children.begin() + child + num, curr->childid);
+            curr->slotuse = static_cast<unsigned short>(num - 1);
+
+            child += num;
+            num_children -= num;
+        }
+
+        BTREE_ASSERT(num_children == 0);
+    }
+
+    /// Count the items a leaf holds after merging [first,last) into its num
+    /// old keys, dropping new items whose key is present.
+    template <typename Iterator>
+    size_type insert_sorted_count(const key_type *oldkey, unsigned short num,
+                                  Iterator first, Iterator last) const
+    {
+        size_type count = 0;
+        const key_type *prev = NULL;
+        unsigned short slot = 0;
+
+        while (slot < num || first != last)
+        {
+            if (first == last || (slot < num && !key_less(value_key(*first), oldkey[slot]))) {
+                prev = &oldkey[slot++];
+            }
+            else {
+                if (!prev || !key_equal(*prev, value_key(*first))) {
+                    prev = &value_key(*first);
+                    ++count;
+                }
+                ++first;
+                continue;
+            }
+            ++count;
+        }
+
+        return count;
+    }
+
+    /// Test if key was the last one placed by insert_sorted_leaf(), which
+    /// fills leaf and the leaves after it up to curr.
+    bool insert_sorted_placed(const leaf_node *leaf, const leaf_node *curr, const key_type &key) const
+    {
+        if (curr->slotuse == 0)
+        {
+            if (curr == leaf) return false;
+            curr = curr->prevleaf;
+        }
+
+        return key_equal(curr->slotkey[curr->slotuse - 1], key);
+    }
+
+    /**
+     * @brief Merge the sorted range [first,last) into a leaf.
+     *
+     * The leaf's items are copied aside and merged with the range back into
+     * the leaf. If they do not fit, the merged items are spread evenly over
+     * the leaf and new leaves linked in after it, which are appended to
+     * splits.
+     */
+    template <typename Iterator>
+    void insert_sorted_leaf(leaf_node *leaf, Iterator first, Iterator last,
+                            insert_sorted_splits &splits, size_type &inserted)
+    {
+        BTREE_COUNT(nodes_visited, 1);
+
+        key_type oldkey[leafslotmax];
+        data_type olddata[used_as_set ? 1 : leafslotmax];
+
+        unsigned short num_old = leaf->slotuse;
+
+        std::copy(leaf->slotkey, leaf->slotkey + num_old, oldkey);
+        data_copy(leaf->slotdata, leaf->slotdata + num_old, olddata);
+
+        size_type num_items = allow_duplicates
+            ? num_old + static_cast<size_type>(last - first)
+            : insert_sorted_count(oldkey, num_old, first, last);
+
+        size_type num_leaves = (num_items + leafslotmax - 1) / leafslotmax;
+
+        BTREE_COUNT(leaf_splits, num_leaves - 1);
+
+        leaf_node *curr = leaf;
+        size_type fill = num_items / num_leaves;
+        unsigned short slot = 0;
+
+        curr->slotuse = 0;
+
+        for (size_type i = 0; i < num_leaves; ++i)
+        {
+            if (i > 0)
+            {
+                leaf_node *newleaf = allocate_leaf();
+
+                newleaf->prevleaf = curr;
+                newleaf->nextleaf = curr->nextleaf;
+                if (curr->nextleaf)
+                    curr->nextleaf->prevleaf = newleaf;
+                else
+                    m_tailleaf = newleaf;
+                curr->nextleaf = newleaf;
+
+                splits.push_back(std::make_pair(curr->slotkey[curr->slotuse - 1], static_cast<node*>(newleaf)));
+                curr = newleaf;
+
+                num_items -= fill;
+                fill = num_items / (num_leaves - i);
+            }
+
+            while (curr->slotuse < fill)
+            {
+                if (first == last || (slot < num_old && !key_less(value_key(*first), oldkey[slot])))
+                {
+                    curr->slotkey[curr->slotuse] = oldkey[slot];
+                    data_copy(olddata + slot, olddata + slot + 1, curr->slotdata + curr->slotuse);
+                    ++curr->slotuse;
+                    ++slot;
+                }
+                else if (!allow_duplicates && insert_sorted_placed(leaf, curr, value_key(*first)))
+                {
+                    ++first;
+                }
+                else
+                {
+                    ++curr->slotuse;
+                    curr->set_slot(curr->slotuse - 1, *first);
+                    ++first;
+                    ++inserted;
+                }
+            }
+        }
+
+        BTREE_ASSERT(slot == num_old);
+
+        // without duplicates, items equal to the last key may be left over
+        BTREE_ASSERT(!allow_duplicates || first == last);
+    }
+
 private:
     // *** Support Class Encapsulating Deletion Results
 
@@ -2601,6 +3755,7 @@ public:
 
         if (!m_root) return false;
 
+        BTREE_COUNT(descents, 1);
         result_t result = erase_one_descend(key, m_root, NULL, NULL, NULL, NULL, NULL, 0);
 
         if (!result.has(btree_not_found))
@@ -2638,6 +3793,7 @@ public:
 
         if (!m_root) return;
 
+        BTREE_COUNT(descents, 1);
         result_t result = erase_iter_descend(iter, m_root, NULL, NULL, NULL, NULL, NULL, 0);
 
         if (!result.has(btree_not_found))
@@ -2649,14 +3805,85 @@ public:
         if (selfverify) verify();
     }
 
-#ifdef BTREE_TODO
-    /// Erase all key/data pairs in the range [first,last). This function is
-    /// currently not implemented by the B+ Tree.
-    void erase(iterator /* first */, iterator /* last */)
+    /// Erase all key/data pairs in the range [first,last). Leaves and subtrees
+    /// lying wholly inside the range are unlinked and freed without visiting
+    /// their items, only the nodes on the two paths to first and last are
+    /// trimmed and rebalanced.
+    void erase(iterator first, iterator last)
     {
-        abort();
-    }
+        BTREE_PRINT("btree::erase_range(" << first.currnode << "," << first.currslot << " - " << last.currnode << "," << last.currslot << ") on btree size " << size());
+
+        if (selfverify) verify();
+
+        if (!m_root) return;
+
+        // iterators past the last slot of a leaf point to the next leaf
+        if (first.currslot >= first.currnode->slotuse && first.currnode->nextleaf) {
+            first.currnode = first.currnode->nextleaf;
+            first.currslot = 0;
+        }
+        if (last.currslot >= last.currnode->slotuse && last.currnode->nextleaf) {
+            last.currnode = last.currnode->nextleaf;
+            last.currslot = 0;
+        }
+
+        if (first == last) return;
+
+        bool has_lo = (first != begin());
+        bool has_hi = (last != end());
+
+        if (!has_lo && !has_hi) {
+            clear();
+            return;
+        }
+
+        erase_range_bound lo, hi;
+        key_type boundkey = key_type();
+
+        if (has_lo) {
+            lo.slot = first.currslot;
+            BTREE_COUNT(descents, 1);
+            erase_range_path(m_root, first.currnode, first.currnode->slotkey[0], lo.path);
+        }
+        if (has_hi) {
+            hi.slot = last.currslot;
+            BTREE_COUNT(descents, 1);
+            erase_range_path(m_root, last.currnode, last.currnode->slotkey[0], hi.path);
+            boundkey = last.key();
+        }
+
+        size_type erased = 0;
+        BTREE_COUNT(descents, 1);
+        bool empty = erase_range_descend(m_root, 0, has_lo ? &lo : NULL, has_hi ? &hi : NULL, erased);
+        BTREE_ASSERT(!empty);
+        (void)empty;
+
+        m_stats.itemcount -= erased;
+
+        // cut off roots with a single child, which may leave new underflows
+        // below the new root to be repaired.
+        for (;;)
+        {
+            while (!m_root->isleafnode() && m_root->slotuse == 0)
+            {
+                inner_node *oldroot = static_cast<inner_node*>(m_root);
+                m_root = oldroot->childid[0];
+                free_node(oldroot);
+            }
+
+            if (m_root->isleafnode()) break;
+
+            inner_node *root = static_cast<inner_node*>(m_root);
+            erase_range_repair(root, has_hi ? &boundkey : NULL);
+
+            if (root->slotuse > 0) break;
+        }
+
+#ifdef BTREE_DEBUG
+        if (debug) print(std::cout);
 #endif
+        if (selfverify) verify();
+    }
 
 private:
     // *** Private Erase Functions
@@ -3256,6 +4483,298 @@ private:
         }
     }
 
+    /// One end of the range of erase(first,last): the child slots on the path
+    /// from the root to its leaf, and the slot in the leaf.
+    struct erase_range_bound
+    {
+        std::vector<unsigned short> path;
+        unsigned short slot;
+    };
+
+    /// Find the child slots on the path from n to the given leaf, whose first
+    /// key is passed. Equal keys may span several children, these are tried
+    /// in order until the leaf is found.
+    bool erase_range_path(node *n, const leaf_node *leaf, const key_type &key,
+                          std::vector<unsigned short> &path) const
+    {
+        if (n->isleafnode())
+            return (n == leaf);
+
+        const inner_node *inner = static_cast<const inner_node*>(n);
+
+        for (unsigned short slot = find_lower(inner, key); slot <= inner->slotuse; ++slot)
+        {
+            path.push_back(slot);
+            if (erase_range_path(inner->childid[slot], leaf, key, path))
+                return true;
+            path.pop_back();
+
+            if (slot < inner->slotuse && key_less(key, inner->slotkey[slot]))
+                break;
+        }
+
+        return false;
+    }
+
+    /// Unlink a leaf from the double linked list of leaves.
+    void unlink_leaf(leaf_node *leaf)
+    {
+        if (leaf->prevleaf)
+            leaf->prevleaf->nextleaf = leaf->nextleaf;
+        else
+            m_headleaf = leaf->nextleaf;
+
+        if (leaf->nextleaf)
+            leaf->nextleaf->prevleaf = leaf->prevleaf;
+        else
+            m_tailleaf = leaf->prevleaf;
+    }
+
+    /// Free a whole subtree, unlinking its leaves. Returns the number of
+    /// key/data pairs which were in it.
+    size_type free_subtree(node *n)
+    {
+        size_type count = 0;
+
+        if (n->isleafnode())
+        {
+            leaf_node *leaf = static_cast<leaf_node*>(n);
+            count = leaf->slotuse;
+            unlink_leaf(leaf);
+        }
+        else
+        {
+            inner_node *inner = static_cast<inner_node*>(n);
+
+            for (unsigned short slot = 0; slot < inner->slotuse + 1; ++slot)
+                count += free_subtree(inner->childid[slot]);
+        }
+
+        free_node(n);
+        return count;
+    }
+
+    /// Return the largest key in the subtree of n, which is the last key of
+    /// its rightmost leaf.
+    const key_type& subtree_lastkey(const node *n) const
+    {
+        while (!n->isleafnode())
+        {
+            const inner_node *inner = static_cast<const inner_node*>(n);
+            n = inner->childid[inner->slotuse];
+        }
+
+        const leaf_node *leaf = static_cast<const leaf_node*>(n);
+        BTREE_ASSERT(leaf->slotuse > 0);
+        return leaf->slotkey[leaf->slotuse - 1];
+    }
+
+    /// Free a node emptied by erase_range_descend(), whose children are
+    /// already freed.
+    void erase_range_free(node *n)
+    {
+        if (n->isleafnode())
+            unlink_leaf(static_cast<leaf_node*>(n));
+
+        free_node(n);
+    }
+
+    /** @brief Erase the part of the range [lo,hi) which lies in the subtree of
+     * n, at the given depth below the root.
+     *
+     * A NULL bound means the range extends past that side of the subtree. The
+     * children between the two boundary children are freed as a whole, the
+     * boundary children are descended into and removed once empty. Nodes on
+     * the boundary paths are left underfull and their separator keys stale,
+     * erase_range_repair() fixes both. Returns true if n became empty, in
+     * which case the caller frees it.
+     */
+    bool erase_range_descend(node *n, unsigned int depth,
+                             const erase_range_bound *lo, const erase_range_bound *hi,
+                             size_type &erased)
+    {
+        if (n->isleafnode())
+        {
+            leaf_node *leaf = static_cast<leaf_node*>(n);
+
+            unsigned int begin = lo ? lo->slot : 0;
+            unsigned int end = hi ? hi->slot : leaf->slotuse;
+
+            BTREE_ASSERT(begin <= end && end <= leaf->slotuse);
+
+            std::copy(leaf->slotkey + end, leaf->slotkey + leaf->slotuse,
+                      leaf->slotkey + begin);
+            data_copy(leaf->slotdata + end, leaf->slotdata + leaf->slotuse,
+                      leaf->slotdata + begin);
+
+            leaf->slotuse -= end - begin;
+            erased += end - begin;
+
+            return (leaf->slotuse == 0);
+        }
+
+        inner_node *inner = static_cast<inner_node*>(n);
+
+        unsigned int first = lo ? lo->path[depth] : 0;
+        unsigned int last = hi ? hi->path[depth] : inner->slotuse;
+
+        BTREE_ASSERT(first <= last && last <= inner->slotuse);
+
+        bool first_empty, last_empty;
+
+        if (first == last)
+        {
+            first_empty = last_empty = erase_range_descend(inner->childid[first], depth + 1, lo, hi, erased);
+        }
+        else
+        {
+            first_empty = erase_range_descend(inner->childid[first], depth + 1, lo, NULL, erased);
+            last_empty = erase_range_descend(inner->childid[last], depth + 1, NULL, hi, erased);
+
+            for (unsigned int slot = first + 1; slot < last; ++slot)
+                erased += free_subtree(inner->childid[slot]);
+        }
+
+        // the children [begin,end) are removed from this node
+        unsigned int begin = first_empty ? first : first + 1;
+        unsigned int end = last_empty ? last + 1 : last;
+
+        if (first == last) {
+            begin = first;
+            end = first_empty ? first + 1 : first;
+        }
+
+        if (first_empty)
+            erase_range_free(inner->childid[first]);
+        if (last_empty && last != first)
+            erase_range_free(inner->childid[last]);
+
+        if (begin == end)
+            return false;
+
+        if (begin == 0 && end == inner->slotuse + 1u)
+            return true;
+
+        // remove the separator right of each child, or left of it for the
+        // last children.
+        unsigned int keybegin = (end == inner->slotuse + 1u) ? begin - 1 : begin;
+        unsigned int num = end - begin;
+
+        std::copy(inner->slotkey + keybegin + num, inner->slotkey + inner->slotuse,
+                  inner->slotkey + keybegin);
+        std::copy(inner->childid + end, inner->childid + inner->slotuse + 1,
+                  inner->childid + begin);
+
+        inner->slotuse -= num;
+
+        return false;
+    }
+
+    /** @brief Repair the underfull nodes and stale separator keys left by
+     * erase_range_descend() in the subtree of n.
+     *
+     * These are only found on the paths to the last key/data pair before the
+     * erased range and to boundkey, the first one after it, or to the last
+     * leaf if boundkey is NULL. The two are neighbours, so only the children
+     * that may contain them are descended into. An underfull child is merged
+     * with or balanced against a sibling, which may give a lonely grandchild
+     * siblings to be repaired with, so this is repeated until nothing
+     * changes. Underflow of n itself is left to its parent.
+     */
+    void erase_range_repair(inner_node *n, const key_type *boundkey)
+    {
+        for (;;)
+        {
+            unsigned int begin, end;
+
+            if (boundkey) {
+                begin = find_lower(n, *boundkey);
+                end = find_upper(n, *boundkey);
+                if (begin > 0) --begin;
+            }
+            else {
+                end = n->slotuse;
+                begin = (end > 0) ? end - 1 : 0;
+            }
+
+            for (unsigned int slot = begin; slot <= end; ++slot)
+            {
+                if (!n->childid[slot]->isleafnode())
+                    erase_range_repair(static_cast<inner_node*>(n->childid[slot]), boundkey);
+            }
+
+            for (unsigned int slot = begin; slot <= end && slot < n->slotuse; ++slot)
+                n->slotkey[slot] = subtree_lastkey(n->childid[slot]);
+
+            if (n->slotuse == 0) return;
+
+            unsigned int slot = begin;
+            while (slot <= end && !erase_range_underflow(n->childid[slot]))
+                ++slot;
+
+            if (slot > end) return;
+
+            // balance against the right sibling, or the left one for the last
+            // child, whose separator key may lie outside the checked range.
+            if (slot == n->slotuse)
+                --slot;
+
+            n->slotkey[slot] = subtree_lastkey(n->childid[slot]);
+
+            if (n->level == 1)
+            {
+                leaf_node *left = static_cast<leaf_node*>(n->childid[slot]);
+                leaf_node *right = static_cast<leaf_node*>(n->childid[slot + 1]);
+
+                if (left->slotuse + right->slotuse < leafslotmax) {
+                    merge_leaves(left, right, n);
+                    erase_range_remove_right(n, slot);
+                    free_node(right);
+                }
+                else if (left->slotuse < right->slotuse)
+                    shift_left_leaf(left, right, n, slot);
+                else
+                    shift_right_leaf(left, right, n, slot);
+            }
+            else
+            {
+                inner_node *left = static_cast<inner_node*>(n->childid[slot]);
+                inner_node *right = static_cast<inner_node*>(n->childid[slot + 1]);
+
+                if (left->slotuse + right->slotuse < innerslotmax) {
+                    merge_inner(left, right, n, slot);
+                    erase_range_remove_right(n, slot);
+                    free_node(right);
+                }
+                else if (left->slotuse < right->slotuse)
+                    shift_left_inner(left, right, n, slot);
+                else
+                    shift_right_inner(left, right, n, slot);
+            }
+        }
+    }
+
+    /// Test if a node is underfull, for erase_range_repair().
+    static inline bool erase_range_underflow(const node *n)
+    {
+        if (n->isleafnode())
+            return static_cast<const leaf_node*>(n)->isunderflow();
+        else
+            return static_cast<const inner_node*>(n)->isunderflow();
+    }
+
+    /// Remove the child right of slot and its separator key after the child
+    /// was merged into its left sibling.
+    static void erase_range_remove_right(inner_node *n, unsigned int slot)
+    {
+        std::copy(n->slotkey + slot + 1, n->slotkey + n->slotuse,
+                  n->slotkey + slot);
+        std::copy(n->childid + slot + 2, n->childid + n->slotuse + 1,
+                  n->childid + slot + 1);
+
+        n->slotuse--;
+    }
+
     /// Merge two leaf nodes. The function moves all key/data pairs from right
     /// to left and sets right's slotuse to zero. The right slot is then
     /// removed by the calling parent node.
@@ -3264,6 +4783,8 @@ private:
         BTREE_PRINT("Merge leaf nodes " << left << " and " << right << " with common parent " << parent << ".");
         (void)parent;
 
+        BTREE_COUNT(leaf_merges, 1);
+
         BTREE_ASSERT(left->isleafnode() && right->isleafnode());
         BTREE_ASSERT(parent->level == 1);
 
@@ -3290,10 +4811,12 @@ private:
     /// Merge two inner nodes. The function moves all key/childid pairs from
     /// right to left and sets right's slotuse to zero. The right slot is then
     /// removed by the calling parent node.
-    static result_t merge_inner(inner_node* left, inner_node* right, inner_node* parent, unsigned int parentslot)
+    result_t merge_inner(inner_node* left, inner_node* right, inner_node* parent, unsigned int parentslot)
     {
         BTREE_PRINT("Merge inner nodes " << left << " and " << right << " with common parent " << parent << ".");
 
+        BTREE_COUNT(inner_merges, 1);
+
         BTREE_ASSERT(left->level == right->level);
         BTREE_ASSERT(parent->level == left->level + 1);
 
@@ -3334,11 +4857,13 @@ private:
     /// Balance two leaf nodes. The function moves key/data pairs from right to
     /// left so that both nodes are equally filled. The parent node is updated
     /// if possible.
-    static result_t shift_left_leaf(leaf_node *left, leaf_node *right, inner_node *parent, unsigned int parentslot)
+    result_t shift_left_leaf(leaf_node *left, leaf_node *right, inner_node *parent, unsigned int parentslot)
     {
         BTREE_ASSERT(left->isleafnode() && right->isleafnode());
         BTREE_ASSERT(parent->level == 1);
 
+        BTREE_COUNT(leaf_shifts, 1);
+
         BTREE_ASSERT(left->nextleaf == right);
         BTREE_ASSERT(left == right->prevleaf);
 
@@ -3382,11 +4907,13 @@ private:
     /// Balance two inner nodes. The function moves key/data pairs from right
     /// to left so that both nodes are equally filled. The parent node is
     /// updated if possible.
-    static void shift_left_inner(inner_node *left, inner_node *right, inner_node *parent, unsigned int parentslot)
+    void shift_left_inner(inner_node *left, inner_node *right, inner_node *parent, unsigned int parentslot)
     {
         BTREE_ASSERT(left->level == right->level);
         BTREE_ASSERT(parent->level == left->level + 1);
 
+        BTREE_COUNT(inner_shifts, 1);
+
         BTREE_ASSERT(left->slotuse < right->slotuse);
         BTREE_ASSERT(parent->childid[parentslot] == left);
 
@@ -3440,11 +4967,13 @@ private:
     /// Balance two leaf nodes. The function moves key/data pairs from left to
     /// right so that both nodes are equally filled. The parent node is updated
     /// if possible.
-    static void shift_right_leaf(leaf_node *left, leaf_node *right, inner_node *parent, unsigned int parentslot)
+    void shift_right_leaf(leaf_node *left, leaf_node *right, inner_node *parent, unsigned int parentslot)
     {
         BTREE_ASSERT(left->isleafnode() && right->isleafnode());
         BTREE_ASSERT(parent->level == 1);
 
+        BTREE_COUNT(leaf_shifts, 1);
+
         BTREE_ASSERT(left->nextleaf == right);
         BTREE_ASSERT(left == right->prevleaf);
         BTREE_ASSERT(parent->childid[parentslot] == left);
@@ -3494,11 +5023,13 @@ private:
     /// Balance two inner nodes. The function moves key/data pairs from left to
     /// right so that both nodes are equally filled. The parent node is updated
     /// if possible.
-    static void shift_right_inner(inner_node *left, inner_node *right, inner_node *parent, unsigned int parentslot)
+    void shift_right_inner(inner_node *left, inner_node *right, inner_node *parent, unsigned int parentslot)
     {
         BTREE_ASSERT(left->level == right->level);
         BTREE_ASSERT(parent->level == left->level + 1);
 
+        BTREE_COUNT(inner_shifts, 1);
+
         BTREE_ASSERT(left->slotuse > right->slotuse);
         BTREE_ASSERT(parent->childid[parentslot] == left);
 
@@ -3891,8 +5422,108 @@ public:
         return true;
     }
 
+public:
+    // *** Pointer-free Image of B+ Trees
+
+    /// Layout of the image written by dump_image().
+    typedef btree_image_layout<key_type, data_type, leafslotmax, innerslotmax,
+                               allow_duplicates, used_as_set> image_layout;
+
+    /// Dump the B+ tree onto an ostream as a pointer-free image. Inner nodes
+    /// are written level by level from the root, followed by the leaves in
+    /// their linked order. All links are offsets from the start of the image,
+    /// so a btree_image can search it in place, e.g. directly in a mmap() of
+    /// the file. The image must start at an offset aligned to
+    /// image_layout::alignment. For this to work your key_type and data_type
+    /// must be integral types and contain no pointers or references.
+    void dump_image(std::ostream &os) const
+    {
+        typedef typename image_layout::offset_type offset_type;
+        typedef typename image_layout::inner_node image_inner;
+        typedef typename image_layout::leaf_node image_leaf;
+
+        typename image_layout::header header;
+        header.fill();
+
+        offset_type innerbase = image_layout::align(sizeof(header));
+        offset_type leafbase = image_layout::align(innerbase + m_stats.innernodes * sizeof(image_inner));
+
+        header.itemcount = size();
+        header.leaves = m_stats.leaves;
+        header.innernodes = m_stats.innernodes;
+        header.root = (m_root == NULL) ? 0 : m_root->isleafnode() ? leafbase : innerbase;
+        header.headleaf = (m_headleaf == NULL) ? 0 : leafbase;
+        header.tailleaf = (m_tailleaf == NULL) ? 0 : leafbase + (m_stats.leaves - 1) * sizeof(image_leaf);
+        header.size = leafbase + m_stats.leaves * sizeof(image_leaf);
+
+        os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        dump_image_padding(os, innerbase - sizeof(header));
+
+        // breadth first numbering: the children of each level are numbered
+        // consecutively in the order their parents are written.
+        std::vector<const inner_node*> queue;
+        queue.reserve(m_stats.innernodes);
+        if (m_root && !m_root->isleafnode())
+            queue.push_back(static_cast<const inner_node*>(m_root));
+
+        image_inner inner;
+        offset_type nextinner = 1, nextleaf = 0;
+
+        for (size_t i = 0; i < queue.size(); ++i)
+        {
+            const inner_node *n = queue[i];
+
+            std::fill_n(reinterpret_cast<char*>(&inner), sizeof(inner), 0);
+            inner.level = n->level;
+            inner.slotuse = n->slotuse;
+            std::copy(n->slotkey, n->slotkey + n->slotuse, inner.slotkey);
+
+            for (unsigned short slot = 0; slot <= n->slotuse; ++slot)
+            {
+                if (n->level == 1) {
+                    inner.childid[slot] = leafbase + (nextleaf++) * sizeof(image_leaf);
+                }
+                else {
+                    inner.childid[slot] = innerbase + (nextinner++) * sizeof(image_inner);
+                    queue.push_back(static_cast<const inner_node*>(n->childid[slot]));
+                }
+            }
+
+            os.write(reinterpret_cast<const char*>(&inner), sizeof(inner));
+        }
+
+        BTREE_ASSERT(queue.size() == m_stats.innernodes);
+        BTREE_ASSERT(queue.empty() || nextleaf == m_stats.leaves);
+
+        dump_image_padding(os, leafbase - (innerbase + m_stats.innernodes * sizeof(image_inner)));
+
+        image_leaf leaf;
+        offset_type index = 0;
+
+        for (const leaf_node *n = m_headleaf; n != NULL; n = n->nextleaf, ++index)
+        {
+            std::fill_n(reinterpret_cast<char*>(&leaf), sizeof(leaf), 0);
+            leaf.level = 0;
+            leaf.slotuse = n->slotuse;
+            leaf.prevleaf = (n->prevleaf == NULL) ? 0 : leafbase + (index - 1) * sizeof(image_leaf);
+            leaf.nextleaf = (n->nextleaf == NULL) ? 0 : leafbase + (index + 1) * sizeof(image_leaf);
+            std::copy(n->slotkey, n->slotkey + n->slotuse, leaf.slotkey);
+            data_copy(n->slotdata, n->slotdata + n->slotuse, leaf.slotdata);
+
+            os.write(reinterpret_cast<const char*>(&leaf), sizeof(leaf));
+        }
+
+        BTREE_ASSERT(index == m_stats.leaves);
+    }
+
 private:
 
+    /// Write zero bytes to pad the image up to the next node array.
+    static void dump_image_padding(std::ostream &os, size_t length)
+    {
+        for (; length > 0; --length) os.put(0);
+    }
+
     /// Recursively descend down the tree and dump each node in a precise order
     void dump_node(std::ostream &os, const node* n) const
     {
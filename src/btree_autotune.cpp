@@ -0,0 +1,360 @@
+#include <stdexcept>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <vector>
+#include <limits>
+
+#include "btree_multimap.h"
+#include "btree_frozen.h"
+
+// Sweeps the node sizes and the intra-node search of the index trees in
+// ad_database.h on this host, then the block size of the frozen indexes with
+// the search picked for the trees, and writes the fastest setup as a header
+// which ad_database.h includes when compiled with -DTUNED_TRAITS.
+//
+// Usage: btree_autotune [header] [items] [lookups]
+
+#define DEFAULT_HEADER		"src/btree_tuned.h"
+#define DEFAULT_ITEMS		(1 << 22)
+#define DEFAULT_LOOKUPS		(1 << 18)
+// Average number of items sharing a key, like the lines of a user
+#define KEY_MULTIPLICITY	8
+// Best of this many runs is taken for every setup
+#define REPEATS				3
+
+// Key and data of the index trees, the data are the row ids of ROW_INDEX
+typedef unsigned int TKey;
+typedef unsigned int TData;
+
+// Key of the frozen indexes, laid out like GetKey of GET_INDEX
+struct FrozenKey
+{
+	TKey user_id;
+	TKey ad_id;
+	TKey query_id;
+	unsigned short position;
+	unsigned short depth;
+};
+
+struct FrozenKeyComparer
+{
+	bool operator()(const FrozenKey& k1, const FrozenKey& k2) const
+	{
+		if(k1.user_id != k2.user_id)
+			return k1.user_id < k2.user_id;
+		else if(k1.ad_id != k2.ad_id)
+			return k1.ad_id < k2.ad_id;
+		else if(k1.query_id != k2.query_id)
+			return k1.query_id < k2.query_id;
+		else if(k1.position != k2.position)
+			return k1.position < k2.position;
+		else
+			return k1.depth < k2.depth;
+	}
+};
+
+// Strategies of the intra-node search
+enum strategy
+{
+	SIMD = 0, LINEAR, BINARY
+};
+
+const char* strategy_names[] = { "simd", "linear", "binary" };
+
+// Same order as std::less, but btree_simd_search has no kernel for it, so
+// the tree falls back to the linear or the binary search.
+struct scalar_less
+{
+	bool operator()(const TKey& lhs, const TKey& rhs) const
+	{
+		return lhs < rhs;
+	}
+};
+
+// Threshold of the binary search for every strategy
+template <int _strategy>
+struct strategy_traits
+{
+	typedef std::less<TKey> compare;
+	static const size_t binsearch_threshold = 256;
+};
+
+template <>
+struct strategy_traits<LINEAR>
+{
+	typedef scalar_less compare;
+	static const size_t binsearch_threshold = 256*1024*1024;
+};
+
+template <>
+struct strategy_traits<BINARY>
+{
+	typedef scalar_less compare;
+	static const size_t binsearch_threshold = 0;
+};
+
+template <int _innerSlots, int _leafSlots, int _strategy>
+struct btree_traits_tune : stx::btree_default_map_traits<TKey, TData>
+{
+	static const bool   selfverify = false;
+	static const bool   debug = false;
+
+	static const int    leafslots = _leafSlots;
+	static const int    innerslots = _innerSlots;
+
+	static const size_t binsearch_threshold = strategy_traits<_strategy>::binsearch_threshold;
+};
+
+struct Setup
+{
+	int inner_slots;
+	int leaf_slots;
+	int strategy;
+	double ns_per_lookup;
+};
+
+struct FrozenSetup
+{
+	size_t block_bytes;
+	double ns_per_lookup;
+};
+
+// Load the sorted items into a tree of the setup and time equal_range() of
+// the keys, walking the values found like the queries do.
+template <int _innerSlots, int _leafSlots, int _strategy>
+Setup measure(const std::vector<std::pair<TKey, TData> >& items, const std::vector<TKey>& keys)
+{
+	typedef stx::btree_multimap<TKey, TData,
+								typename strategy_traits<_strategy>::compare,
+								btree_traits_tune<_innerSlots, _leafSlots, _strategy> > Tree;
+
+	Tree tree;
+	tree.bulk_load(items.begin(), items.end());
+
+	double best = std::numeric_limits<double>::max();
+	TData checksum = 0;
+	for(int run = 0; run < REPEATS; run++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		for(const auto& key : keys)
+		{
+			auto range = tree.equal_range(key);
+			for(auto it = range.first; it != range.second; ++it)
+				checksum += it->second;
+		}
+		std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+		best = std::min(best, elapsed.count() / keys.size());
+	}
+
+	Setup setup = { _innerSlots, _leafSlots, _strategy, best };
+	std::cout << "inner " << _innerSlots
+			  << "\tleaf " << _leafSlots
+			  << "\t" << strategy_names[_strategy]
+			  << "\t" << best << " ns"
+			  // Keeps the lookups from being optimized away
+			  << ((checksum == 0) ? " (empty)" : "")
+			  << std::endl;
+	return setup;
+}
+
+// Pack the items into a frozen index of the block size and time its
+// equal_range() like measure() does.
+template <size_t _BlockBytes, int _strategy>
+FrozenSetup measure_frozen(const std::vector<std::pair<FrozenKey, TData> >& items, const std::vector<FrozenKey>& keys)
+{
+	typedef stx::btree_frozen<FrozenKey, TData, FrozenKeyComparer,
+							  btree_traits_tune<16, 16, _strategy>, _BlockBytes> Frozen;
+
+	Frozen frozen;
+	frozen.assign(items.begin(), items.end());
+
+	double best = std::numeric_limits<double>::max();
+	TData checksum = 0;
+	for(int run = 0; run < REPEATS; run++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		for(const auto& key : keys)
+		{
+			auto range = frozen.equal_range(key);
+			for(auto it = range.first; it != range.second; ++it)
+				checksum += it->second;
+		}
+		std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+		best = std::min(best, elapsed.count() / keys.size());
+	}
+
+	FrozenSetup setup = { _BlockBytes, best };
+	std::cout << "frozen block " << _BlockBytes
+			  << "	" << strategy_names[_strategy]
+			  << "	" << best << " ns"
+			  << ((checksum == 0) ? " (empty)" : "")
+			  << std::endl;
+	return setup;
+}
+
+// Sweep the block sizes of the frozen indexes for a strategy, the blocks
+// hold 16 to 128 keys of the size of FrozenKey.
+template <int _strategy>
+void sweep_blocks(const std::vector<std::pair<FrozenKey, TData> >& items, const std::vector<FrozenKey>& keys,
+				  std::vector<FrozenSetup>& setups)
+{
+	setups.push_back(measure_frozen<256, _strategy>(items, keys));
+	setups.push_back(measure_frozen<512, _strategy>(items, keys));
+	setups.push_back(measure_frozen<1024, _strategy>(items, keys));
+	setups.push_back(measure_frozen<2048, _strategy>(items, keys));
+}
+
+// Sweep the leaf sizes for an inner size and a strategy
+template <int _innerSlots, int _strategy>
+void sweep_leaves(const std::vector<std::pair<TKey, TData> >& items, const std::vector<TKey>& keys,
+				  std::vector<Setup>& setups)
+{
+	setups.push_back(measure<_innerSlots, 16, _strategy>(items, keys));
+	setups.push_back(measure<_innerSlots, 32, _strategy>(items, keys));
+	setups.push_back(measure<_innerSlots, 64, _strategy>(items, keys));
+	setups.push_back(measure<_innerSlots, 128, _strategy>(items, keys));
+	setups.push_back(measure<_innerSlots, 256, _strategy>(items, keys));
+}
+
+template <int _strategy>
+void sweep(const std::vector<std::pair<TKey, TData> >& items, const std::vector<TKey>& keys,
+		   std::vector<Setup>& setups)
+{
+	sweep_leaves<16, _strategy>(items, keys, setups);
+	sweep_leaves<32, _strategy>(items, keys, setups);
+	sweep_leaves<64, _strategy>(items, keys, setups);
+	sweep_leaves<128, _strategy>(items, keys, setups);
+	sweep_leaves<256, _strategy>(items, keys, setups);
+}
+
+size_t binsearch_threshold(int _strategy)
+{
+	switch(_strategy)
+	{
+		case LINEAR:
+			return strategy_traits<LINEAR>::binsearch_threshold;
+		case BINARY:
+			return strategy_traits<BINARY>::binsearch_threshold;
+		default:
+			return strategy_traits<SIMD>::binsearch_threshold;
+	}
+}
+
+void write_header(const std::string& path, const Setup& best, const FrozenSetup& best_frozen, size_t num_items)
+{
+	std::ofstream os(path, std::ofstream::out | std::ofstream::trunc);
+	if(!os.is_open())
+		throw std::runtime_error("write_header(): Fail to open file.");
+
+	os << "// Generated by btree_autotune for " << num_items << " items, "
+	   << best.ns_per_lookup << " ns per lookup." << std::endl
+	   << "// The Makefile compiles with -DTUNED_TRAITS while this file exists, run" << std::endl
+	   << "// 'make autotune' again after moving to another host." << std::endl
+	   << "#ifndef _BTREE_TUNED_H" << std::endl
+	   << "#define _BTREE_TUNED_H" << std::endl
+	   << std::endl
+	   << "#define TUNED_INNER_SLOTS\t\t" << best.inner_slots << std::endl
+	   << "#define TUNED_LEAF_SLOTS\t\t" << best.leaf_slots << std::endl
+	   << "#define TUNED_BIN_THRESHOLD\t\t" << binsearch_threshold(best.strategy) << std::endl
+	   << "#define BTREE_FROZEN_BLOCK\t\t" << best_frozen.block_bytes << std::endl;
+	if(best.strategy != SIMD)
+		os << "#define BTREE_NO_SIMD" << std::endl;
+	os << std::endl
+	   << "#endif" << std::endl;
+
+	if(!os.good())
+		throw std::runtime_error("write_header(): Fail to write file.");
+}
+
+int main(int argc, char* argv[])
+{
+	try
+	{
+		std::string header = (argc > 1) ? argv[1] : DEFAULT_HEADER;
+		size_t num_items = (argc > 2) ? std::strtoul(argv[2], NULL, 10) : DEFAULT_ITEMS;
+		size_t num_lookups = (argc > 3) ? std::strtoul(argv[3], NULL, 10) : DEFAULT_LOOKUPS;
+		if(num_items < KEY_MULTIPLICITY || num_lookups == 0)
+			throw std::runtime_error("main(): Too few items or lookups.");
+
+		// Items with keys of several lines each, in the order bulk_load() needs
+		std::mt19937 rng(2012);
+		std::uniform_int_distribution<TKey> key_dist(0, num_items / KEY_MULTIPLICITY);
+		std::vector<std::pair<TKey, TData> > items(num_items);
+		for(size_t idx = 0; idx < num_items; idx++)
+			items[idx] = std::make_pair(key_dist(rng), (TData)idx);
+		std::sort(items.begin(), items.end());
+
+		// Lookups of present keys in random order
+		std::uniform_int_distribution<size_t> item_dist(0, num_items - 1);
+		std::vector<TKey> keys(num_lookups);
+		for(auto& key : keys)
+			key = items[item_dist(rng)].first;
+
+		std::vector<Setup> setups;
+		if(stx::btree_simd_search<TKey, std::less<TKey> >::available)
+			sweep<SIMD>(items, keys, setups);
+		sweep<LINEAR>(items, keys, setups);
+		sweep<BINARY>(items, keys, setups);
+
+		const Setup& best = *std::min_element(setups.begin(), setups.end(),
+											  [](const Setup& lhs, const Setup& rhs)
+											  	{
+											  		return lhs.ns_per_lookup < rhs.ns_per_lookup;
+											  	});
+		std::cout << "Best: inner " << best.inner_slots
+				  << ", leaf " << best.leaf_slots
+				  << ", " << strategy_names[best.strategy] << std::endl;
+
+		// The frozen indexes share the search with the trees, their keys
+		// have no vectorized kernel so only the threshold matters.
+		std::vector<std::pair<FrozenKey, TData> > frozen_items(num_items);
+		for(size_t idx = 0; idx < num_items; idx++)
+		{
+			FrozenKey key = { items[idx].first, items[idx].first % 7, items[idx].first % 5, 1, 1 };
+			frozen_items[idx] = std::make_pair(key, items[idx].second);
+		}
+		std::vector<FrozenKey> frozen_keys(num_lookups);
+		for(size_t idx = 0; idx < num_lookups; idx++)
+		{
+			FrozenKey key = { keys[idx], keys[idx] % 7, keys[idx] % 5, 1, 1 };
+			frozen_keys[idx] = key;
+		}
+
+		std::vector<FrozenSetup> frozen_setups;
+		switch(best.strategy)
+		{
+			case LINEAR:
+				sweep_blocks<LINEAR>(frozen_items, frozen_keys, frozen_setups);
+				break;
+			case BINARY:
+				sweep_blocks<BINARY>(frozen_items, frozen_keys, frozen_setups);
+				break;
+			default:
+				sweep_blocks<SIMD>(frozen_items, frozen_keys, frozen_setups);
+				break;
+		}
+
+		const FrozenSetup& best_frozen = *std::min_element(frozen_setups.begin(), frozen_setups.end(),
+														   [](const FrozenSetup& lhs, const FrozenSetup& rhs)
+														   	{
+														   		return lhs.ns_per_lookup < rhs.ns_per_lookup;
+														   	});
+		std::cout << "Best: frozen block " << best_frozen.block_bytes << std::endl;
+
+		write_header(header, best, best_frozen, num_items);
+		std::cout << "Traits written to " << header << std::endl;
+	}
+	catch(const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
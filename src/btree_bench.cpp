@@ -0,0 +1,480 @@
+#include <stdexcept>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <vector>
+#include <map>
+
+#ifdef TUNED_TRAITS
+#include "btree_tuned.h"
+#endif
+#include "btree_multimap.h"
+
+// Microbenchmarks of btree_multimap against std::multimap. Every benchmark is
+// repeated on the same seeded data, the time of each batch of operations is
+// a sample, and the percentiles of the samples are reported in nanoseconds
+// per operation.
+//
+// Usage: btree_bench [filter] [max items]
+// Only the benchmarks whose name contains the filter are run.
+
+#define DEFAULT_MAX_ITEMS	(1 << 20)
+#define REPEATS				5
+// Operations timed together as one sample
+#define BATCH				64
+// Most lookups done by a benchmark
+#define MAX_LOOKUPS			(1 << 16)
+#define SEED				2012
+
+#ifndef TUNED_TRAITS
+#define INNER_SLOTS			128
+#define LEAF_SLOTS			128
+#define BIN_THRESHOLD		256
+#else
+#define INNER_SLOTS			TUNED_INNER_SLOTS
+#define LEAF_SLOTS			TUNED_LEAF_SLOTS
+#define BIN_THRESHOLD		TUNED_BIN_THRESHOLD
+#endif
+
+typedef unsigned int TKey;
+typedef size_t TData;
+typedef std::pair<TKey, TData> Item;
+
+// Same setup as the index trees in ad_database.h
+struct btree_traits_bench : stx::btree_default_map_traits<TKey, TData>
+{
+	static const bool   selfverify = false;
+	static const bool   debug = false;
+
+	static const int    leafslots = LEAF_SLOTS;
+	static const int    innerslots = INNER_SLOTS;
+
+	static const size_t binsearch_threshold = BIN_THRESHOLD;
+};
+
+typedef stx::btree_multimap<TKey, TData, std::less<TKey>, btree_traits_bench> BTree;
+typedef std::multimap<TKey, TData> StdMap;
+
+// Operations which are not common to both containers
+template <typename Map>
+struct map_ops;
+
+template <>
+struct map_ops<BTree>
+{
+	static const char* name() { return "btree"; }
+
+	static void bulk_load(BTree& map, const std::vector<Item>& sorted)
+	{
+		map.bulk_load(sorted.begin(), sorted.end());
+	}
+};
+
+template <>
+struct map_ops<StdMap>
+{
+	static const char* name() { return "std::multimap"; }
+
+	// Appending with a hint is the closest std::multimap has
+	static void bulk_load(StdMap& map, const std::vector<Item>& sorted)
+	{
+		for(const auto& item : sorted)
+			map.insert(map.end(), item);
+	}
+};
+
+// Key distributions
+enum distribution
+{
+	UNIFORM = 0, SEQUENTIAL, ZIPF, DENSE
+};
+
+const char* distribution_names[] = { "uniform", "sequential", "zipf", "dense" };
+
+// Items of the distribution, in insertion order. The data is the index of
+// the item.
+std::vector<Item> generate(int dist, size_t num_items)
+{
+	std::mt19937 rng(SEED);
+	std::vector<Item> items(num_items);
+	switch(dist)
+	{
+		case UNIFORM:
+		{
+			std::uniform_int_distribution<TKey> key_dist;
+			for(size_t idx = 0; idx < num_items; idx++)
+				items[idx] = Item(key_dist(rng), idx);
+			break;
+		}
+		case SEQUENTIAL:
+		{
+			for(size_t idx = 0; idx < num_items; idx++)
+				items[idx] = Item((TKey)idx, idx);
+			break;
+		}
+		case ZIPF:
+		{
+			// Key k is drawn with a weight of 1/k, the few top keys hold most
+			// of the items like the busiest users and ads do.
+			size_t num_keys = std::max<size_t>(num_items / 4, 1);
+			std::vector<double> cdf(num_keys);
+			double sum = 0.0;
+			for(size_t k = 0; k < num_keys; k++)
+				cdf[k] = (sum += 1.0 / (k + 1));
+			std::uniform_real_distribution<double> weight_dist(0.0, sum);
+			for(size_t idx = 0; idx < num_items; idx++)
+			{
+				size_t k = std::lower_bound(cdf.begin(), cdf.end(), weight_dist(rng)) - cdf.begin();
+				items[idx] = Item((TKey)std::min(k, num_keys - 1), idx);
+			}
+			break;
+		}
+		default:
+		{
+			// About eight items per key
+			std::uniform_int_distribution<TKey> key_dist(0, std::max<size_t>(num_items / 8, 1));
+			for(size_t idx = 0; idx < num_items; idx++)
+				items[idx] = Item(key_dist(rng), idx);
+			break;
+		}
+	}
+	return items;
+}
+
+// Keys to look up, the present keys in random order. Every key is equally
+// likely however many items it has, so the heavy keys of a skewed
+// distribution don't take over the benchmark.
+std::vector<TKey> lookup_keys(const std::vector<Item>& items)
+{
+	std::vector<TKey> present(items.size());
+	for(size_t idx = 0; idx < items.size(); idx++)
+		present[idx] = items[idx].first;
+	std::sort(present.begin(), present.end());
+	present.erase(std::unique(present.begin(), present.end()), present.end());
+
+	std::mt19937 rng(SEED + 1);
+	std::uniform_int_distribution<size_t> key_dist(0, present.size() - 1);
+	std::vector<TKey> keys(std::min<size_t>(items.size(), MAX_LOOKUPS));
+	for(auto& key : keys)
+		key = present[key_dist(rng)];
+	return keys;
+}
+
+// Samples of a benchmark, in nanoseconds per operation
+typedef std::vector<double> Samples;
+
+class Bench
+{
+private:
+	std::string filter;
+	bool header_printed = false;
+
+public:
+	Bench(const std::string& _filter)
+		: filter(_filter)
+	{
+	}
+
+	bool enabled(const std::string& name) const
+	{
+		return name.find(filter) != std::string::npos;
+	}
+
+	// Print the percentiles of the samples
+	void report(const std::string& name, Samples samples)
+	{
+		if(!header_printed)
+		{
+			std::cout << std::left << std::setw(48) << "Benchmark" << std::right
+					  << std::setw(10) << "samples"
+					  << std::setw(10) << "p50"
+					  << std::setw(10) << "p90"
+					  << std::setw(10) << "p99"
+					  << std::setw(10) << "max"
+					  << "  (ns/op)" << std::endl;
+			header_printed = true;
+		}
+
+		std::sort(samples.begin(), samples.end());
+		std::cout << std::left << std::setw(48) << name << std::right
+				  << std::setw(10) << samples.size() << std::fixed << std::setprecision(1)
+				  << std::setw(10) << percentile(samples, 0.50)
+				  << std::setw(10) << percentile(samples, 0.90)
+				  << std::setw(10) << percentile(samples, 0.99)
+				  << std::setw(10) << samples.back()
+				  << std::endl;
+	}
+
+private:
+	static double percentile(const Samples& sorted, double ratio)
+	{
+		if(sorted.empty())
+			return 0.0;
+		size_t idx = (size_t)(ratio * (sorted.size() - 1) + 0.5);
+		return sorted[idx];
+	}
+};
+
+// Time op(idx) for all idx below count in batches, one sample per batch
+template <typename Op>
+void time_batches(size_t count, Op op, Samples& samples)
+{
+	for(size_t first = 0; first < count; first += BATCH)
+	{
+		size_t last = std::min(first + BATCH, count);
+		auto start = std::chrono::steady_clock::now();
+		for(size_t idx = first; idx < last; idx++)
+			op(idx);
+		std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+		samples.push_back(elapsed.count() / (last - first));
+	}
+}
+
+// Time op() once as a single sample of count operations
+template <typename Op>
+void time_once(size_t count, Op op, Samples& samples)
+{
+	auto start = std::chrono::steady_clock::now();
+	op();
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	samples.push_back(elapsed.count() / std::max<size_t>(count, 1));
+}
+
+// Keeps the results of the lookups from being optimized away
+volatile TData sink;
+
+template <typename Map>
+void bench_map(Bench& bench, int dist, const std::vector<Item>& items)
+{
+	std::ostringstream prefix;
+	prefix << map_ops<Map>::name() << "/" << distribution_names[dist] << "/";
+	std::string suffix = "/" + std::to_string(items.size());
+
+	std::vector<Item> sorted(items);
+	std::stable_sort(sorted.begin(), sorted.end(),
+					 [](const Item& lhs, const Item& rhs)
+					 	{
+					 		return lhs.first < rhs.first;
+					 	});
+
+	std::vector<TKey> keys = lookup_keys(items);
+
+	std::string name = prefix.str() + "insert" + suffix;
+	if(bench.enabled(name))
+	{
+		Samples samples;
+		for(int run = 0; run < REPEATS; run++)
+		{
+			Map map;
+			time_batches(items.size(), [&](size_t idx) { map.insert(items[idx]); }, samples);
+		}
+		bench.report(name, samples);
+	}
+
+	name = prefix.str() + "bulk_load" + suffix;
+	if(bench.enabled(name))
+	{
+		Samples samples;
+		for(int run = 0; run < REPEATS; run++)
+		{
+			Map map;
+			time_once(sorted.size(), [&]() { map_ops<Map>::bulk_load(map, sorted); }, samples);
+		}
+		bench.report(name, samples);
+	}
+
+	Map map;
+	map_ops<Map>::bulk_load(map, sorted);
+
+	name = prefix.str() + "find" + suffix;
+	if(bench.enabled(name))
+	{
+		Samples samples;
+		for(int run = 0; run < REPEATS; run++)
+			time_batches(keys.size(), [&](size_t idx) { sink = map.find(keys[idx])->second; }, samples);
+		bench.report(name, samples);
+	}
+
+	name = prefix.str() + "equal_range" + suffix;
+	if(bench.enabled(name))
+	{
+		Samples samples;
+		for(int run = 0; run < REPEATS; run++)
+		{
+			time_batches(keys.size(), [&](size_t idx)
+				{
+					auto range = map.equal_range(keys[idx]);
+					for(auto it = range.first; it != range.second; ++it)
+						sink = it->second;
+				}, samples);
+		}
+		bench.report(name, samples);
+	}
+
+	name = prefix.str() + "count" + suffix;
+	if(bench.enabled(name))
+	{
+		Samples samples;
+		for(int run = 0; run < REPEATS; run++)
+			time_batches(keys.size(), [&](size_t idx) { sink = map.count(keys[idx]); }, samples);
+		bench.report(name, samples);
+	}
+
+	name = prefix.str() + "iterate" + suffix;
+	if(bench.enabled(name))
+	{
+		Samples samples;
+		for(int run = 0; run < REPEATS; run++)
+		{
+			time_once(map.size(), [&]()
+				{
+					TData sum = 0;
+					for(auto it = map.begin(); it != map.end(); ++it)
+						sum += it->second;
+					sink = sum;
+				}, samples);
+		}
+		bench.report(name, samples);
+	}
+
+	name = prefix.str() + "erase" + suffix;
+	if(bench.enabled(name))
+	{
+		Samples samples;
+		for(int run = 0; run < REPEATS; run++)
+		{
+			// Every lookup key is erased once, missing keys cost a search
+			Map victim(map);
+			time_batches(keys.size(), [&](size_t idx) { sink = victim.erase(keys[idx]); }, samples);
+		}
+		bench.report(name, samples);
+	}
+}
+
+// Dump and restore only exist for the B+ tree
+void bench_dump(Bench& bench, int dist, const std::vector<Item>& items)
+{
+	std::ostringstream prefix;
+	prefix << map_ops<BTree>::name() << "/" << distribution_names[dist] << "/";
+	std::string suffix = "/" + std::to_string(items.size());
+
+	std::vector<Item> sorted(items);
+	std::stable_sort(sorted.begin(), sorted.end(),
+					 [](const Item& lhs, const Item& rhs)
+					 	{
+					 		return lhs.first < rhs.first;
+					 	});
+	BTree map;
+	map.bulk_load(sorted.begin(), sorted.end());
+
+	std::string name = prefix.str() + "dump" + suffix;
+	if(bench.enabled(name))
+	{
+		Samples samples;
+		for(int run = 0; run < REPEATS; run++)
+		{
+			std::ostringstream os;
+			time_once(map.size(), [&]() { map.dump(os); }, samples);
+		}
+		bench.report(name, samples);
+	}
+
+	name = prefix.str() + "restore" + suffix;
+	if(bench.enabled(name))
+	{
+		std::ostringstream os;
+		map.dump(os);
+		std::string dump = os.str();
+
+		Samples samples;
+		for(int run = 0; run < REPEATS; run++)
+		{
+			std::istringstream is(dump);
+			BTree restored;
+			time_once(map.size(), [&]()
+				{
+					if(!restored.restore(is))
+						throw std::runtime_error("bench_dump(): Fail to restore the tree.");
+				}, samples);
+		}
+		bench.report(name, samples);
+	}
+
+	name = prefix.str() + "dump_image" + suffix;
+	if(bench.enabled(name))
+	{
+		Samples samples;
+		for(int run = 0; run < REPEATS; run++)
+		{
+			std::ostringstream os;
+			time_once(map.size(), [&]() { map.dump_image(os); }, samples);
+		}
+		bench.report(name, samples);
+	}
+
+	name = prefix.str() + "image_equal_range" + suffix;
+	if(bench.enabled(name))
+	{
+		std::ostringstream os;
+		map.dump_image(os);
+		std::string image_data = os.str();
+
+		BTree::image_type image;
+		if(image.attach(image_data.data(), image_data.size()) == 0)
+			throw std::runtime_error("bench_dump(): Fail to attach the image.");
+
+		std::vector<TKey> keys = lookup_keys(items);
+
+		Samples samples;
+		for(int run = 0; run < REPEATS; run++)
+		{
+			time_batches(keys.size(), [&](size_t idx)
+				{
+					auto range = image.equal_range(keys[idx]);
+					for(auto it = range.first; it != range.second; ++it)
+						sink = it->second;
+				}, samples);
+		}
+		bench.report(name, samples);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	try
+	{
+		Bench bench((argc > 1) ? argv[1] : "");
+		size_t max_items = (argc > 2) ? std::strtoul(argv[2], NULL, 10) : DEFAULT_MAX_ITEMS;
+		if(max_items == 0)
+			throw std::runtime_error("main(): Too few items.");
+
+		// Sizes growing by 32 times up to the maximum, from a thousand items on
+		std::vector<size_t> sizes(1, max_items);
+		for(size_t size = max_items / 32; size >= 1024 && sizes.size() < 3; size /= 32)
+			sizes.insert(sizes.begin(), size);
+
+		for(const auto& size : sizes)
+		{
+			for(int dist = UNIFORM; dist <= DENSE; dist++)
+			{
+				std::vector<Item> items = generate(dist, size);
+				bench_map<BTree>(bench, dist, items);
+				bench_map<StdMap>(bench, dist, items);
+				bench_dump(bench, dist, items);
+			}
+		}
+	}
+	catch(const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,765 @@
+/** \file btree_frozen.h
+ * Contains the read-only container btree_frozen, which packs the items of a
+ * built B+ tree into contiguous arrays searched by implicit addressing.
+ */
+
+/*
+ * STX B+ Tree Template Classes v0.9
+ * Copyright (C) 2008-2013 Timo Bingmann
+ *
+ * Boost Software License - Version 1.0 - August 17th, 2003
+ *
+ * Permission is hereby granted, free of charge, to any person or organization
+ * obtaining a copy of the software and accompanying documentation covered by
+ * this license (the "Software") to use, reproduce, display, distribute,
+ * execute, and transmit the Software, and to prepare derivative works of the
+ * Software, and to permit third-parties to whom the Software is furnished to
+ * do so, all subject to the following:
+ *
+ * The copyright notices in the Software and this entire statement, including
+ * the above license grant, this restriction and the following disclaimer, must
+ * be included in all copies of the Software, in whole or in part, and all
+ * derivative works of the Software, unless such copies or derivative works are
+ * solely in the form of machine-executable object code generated by a source
+ * language processor.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+ * SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+ * FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _STX_BTREE_FROZEN_H_
+#define _STX_BTREE_FROZEN_H_
+
+#include <vector>
+#include <ostream>
+#include <iterator>
+
+#include "btree.h"
+
+#ifndef BTREE_FROZEN_BLOCK
+/// Default size of a block of small keys of btree_frozen in bytes, one cache
+/// line. It can be overridden before including the header, or for a single
+/// container by its fifth template parameter.
+#define BTREE_FROZEN_BLOCK      64
+#endif
+
+namespace stx {
+
+/** Header in front of the image of a btree_frozen. The data array and the
+ * key levels follow, each at the next aligned offset. */
+struct btree_frozen_header
+{
+    /// "stx-frozen", just to stop attach() from using garbage
+    char                signature[12];
+
+    /// Currently 0
+    unsigned short      version;
+
+    /// sizeof(key_type)
+    unsigned short      key_type_size;
+
+    /// sizeof(data_type)
+    unsigned short      data_type_size;
+
+    /// Number of keys in a block
+    unsigned short      blockslots;
+
+    /// Number of key/data pairs
+    unsigned long long  itemcount;
+
+    /// Size of the whole image in bytes
+    unsigned long long  size;
+
+    /// Fill the struct with the properties of the instantiation, the counts
+    /// are not filled.
+    inline void fill(unsigned short keysize, unsigned short datasize, unsigned short slots)
+    {
+        std::fill_n(reinterpret_cast<char*>(this), sizeof(*this), 0);
+        std::copy("stx-frozen", "stx-frozen" + 10, signature);
+        version = 0;
+        key_type_size = keysize;
+        data_type_size = datasize;
+        blockslots = slots;
+    }
+
+    /// Returns true if the headers have the same vital properties
+    inline bool same(const btree_frozen_header &o) const
+    {
+        return std::equal(signature, signature + 12, o.signature)
+            && (version == o.version)
+            && (key_type_size == o.key_type_size)
+            && (data_type_size == o.data_type_size)
+            && (blockslots == o.blockslots);
+    }
+};
+
+/** @brief Read-only multimap packed from a built B+ tree.
+ *
+ * A B+ tree which is only read after it is built still carries the slack of
+ * its nodes and follows a pointer per level. btree_frozen instead keeps the
+ * keys level by level in contiguous arrays of cache line sized blocks. Level
+ * 0 holds all keys in order, with the data in a parallel array, and every
+ * level above holds the last key of each block of the level below. The
+ * children of block b are the blocks b * blockslots + i of the next level, so
+ * a lookup computes its next block instead of loading a pointer, and the
+ * memory is close to the raw size of the keys and data.
+ *
+ * Blocks are _BlockBytes large but hold at least 16 keys.
+ *
+ * The arrays lie in one buffer behind a btree_frozen_header. The container
+ * owns the buffer when it is built by assign(), or is a view of an image
+ * written by dump_image() when attached, usually to a mmap() of a file.
+ */
+template <typename _Key, typename _Data,
+          typename _Compare = std::less<_Key>,
+          typename _Traits = btree_default_map_traits<_Key, _Data>,
+          size_t _BlockBytes = BTREE_FROZEN_BLOCK>
+class btree_frozen
+{
+public:
+    // *** Template Parameter Types
+
+    /// First template parameter: The key type
+    typedef _Key                        key_type;
+
+    /// Second template parameter: The data type associated with each key
+    typedef _Data                       data_type;
+
+    /// Third template parameter: Key comparison function object
+    typedef _Compare                    key_compare;
+
+    /// Fourth template parameter: Traits object, only the intra-node search
+    /// threshold is used
+    typedef _Traits                     traits;
+
+public:
+    // *** Constructed Types
+
+    /// Typedef of our own type
+    typedef btree_frozen<key_type, data_type, key_compare, traits, _BlockBytes> self;
+
+    /// Size type used to count keys
+    typedef size_t                              size_type;
+
+    /// The pair of key_type and data_type, returned by the iterators.
+    typedef std::pair<key_type, data_type>      value_type;
+
+    /// Number of keys in a block. Blocks of large keys span several cache
+    /// lines, so that the levels above level 0 stay below a fifteenth of it.
+    static const unsigned short         blockslots =
+        BTREE_MAX(_BlockBytes / sizeof(key_type), 16);
+
+    /// Alignment of the arrays in the image. The image itself has to start
+    /// at an address aligned to this, which is no more than a cache line for
+    /// small keys even if the blocks are larger.
+    static const size_t                 alignment =
+        BTREE_MAX(BTREE_MAX(sizeof(key_type), sizeof(data_type)), (_BlockBytes < 64 ? _BlockBytes : 64));
+
+    /// Maximum number of levels, enough for any item count.
+    static const int                    maxlevels = 16;
+
+    /// Debug parameter: Prints out debug information. Requires the header
+    /// file to be compiled with BTREE_DEBUG.
+    static const bool                   debug = traits::debug;
+
+public:
+    // *** Iterators
+
+    /// STL-like read-only iterator object. The iterator points to a position
+    /// in the level 0 keys and the data.
+    class const_iterator
+    {
+    public:
+        // *** Types
+
+        /// The key type of the container. Returned by key().
+        typedef typename btree_frozen::key_type         key_type;
+
+        /// The data type of the container. Returned by data().
+        typedef typename btree_frozen::data_type        data_type;
+
+        /// The value type of the container. Returned by operator*().
+        typedef typename btree_frozen::value_type       value_type;
+
+        /// Reference to the value_type. STL required.
+        typedef const value_type&               reference;
+
+        /// Pointer to the value_type. STL required.
+        typedef const value_type*               pointer;
+
+        /// STL-magic iterator category
+        typedef std::bidirectional_iterator_tag         iterator_category;
+
+        /// STL-magic
+        typedef ptrdiff_t               difference_type;
+
+        /// Our own type
+        typedef const_iterator          self;
+
+    private:
+        // *** Members
+
+        /// The level 0 keys
+        const key_type*                 keys;
+
+        /// The data array
+        const data_type*                datas;
+
+        /// Current position
+        size_type                       pos;
+
+        /// Evil! A temporary value_type to STL-correctly deliver operator* and
+        /// operator->
+        mutable value_type              temp_value;
+
+    public:
+        // *** Methods
+
+        /// Default-Constructor of a const iterator
+        inline const_iterator()
+            : keys(NULL), datas(NULL), pos(0)
+        { }
+
+        /// Initializing-Constructor of a const iterator
+        inline const_iterator(const key_type *k, const data_type *d, size_type p)
+            : keys(k), datas(d), pos(p)
+        { }
+
+        /// Dereference the iterator. Do not use this if possible, use key()
+        /// and data() instead.
+        inline reference operator*() const
+        {
+            temp_value = value_type(key(), data());
+            return temp_value;
+        }
+
+        /// Dereference the iterator. Do not use this if possible, use key()
+        /// and data() instead.
+        inline pointer operator->() const
+        {
+            temp_value = value_type(key(), data());
+            return &temp_value;
+        }
+
+        /// Key of the current position
+        inline const key_type& key() const
+        {
+            return keys[pos];
+        }
+
+        /// Read-only reference to the current data object
+        inline const data_type& data() const
+        {
+            return datas[pos];
+        }
+
+        /// Prefix++ advance the iterator to the next position
+        inline self& operator++()
+        {
+            ++pos;
+            return *this;
+        }
+
+        /// Postfix++ advance the iterator to the next position
+        inline self operator++(int)
+        {
+            self tmp = *this;   // copy ourselves
+            ++pos;
+            return tmp;
+        }
+
+        /// Prefix-- backstep the iterator to the last position
+        inline self& operator--()
+        {
+            --pos;
+            return *this;
+        }
+
+        /// Postfix-- backstep the iterator to the last position
+        inline self operator--(int)
+        {
+            self tmp = *this;   // copy ourselves
+            --pos;
+            return tmp;
+        }
+
+        /// Equality of iterators
+        inline bool operator==(const self& x) const
+        {
+            return (x.keys == keys) && (x.pos == pos);
+        }
+
+        /// Inequality of iterators
+        inline bool operator!=(const self& x) const
+        {
+            return (x.keys != keys) || (x.pos != pos);
+        }
+    };
+
+private:
+    // *** Data Members
+
+    /// Buffer of the image when it was built by assign()
+    std::vector<char>   m_storage;
+
+    /// Header of the image, NULL if neither built nor attached
+    const btree_frozen_header*  m_header;
+
+    /// The data array
+    const data_type*    m_data;
+
+    /// Keys of every level, level 0 holds all keys
+    const key_type*     m_level[maxlevels];
+
+    /// Number of levels, 0 if empty
+    int                 m_levels;
+
+    /// Key comparison object. More comparison functions are generated from
+    /// this < relation.
+    key_compare         m_key_less;
+
+private:
+    /// The buffer is referred to by pointers, copies are not supported
+    btree_frozen(const self &other);
+
+    /// The buffer is referred to by pointers, copies are not supported
+    self& operator=(const self &other);
+
+public:
+    // *** Constructors, Building and Attaching
+
+    /// Default constructor of an empty container
+    explicit inline btree_frozen(const key_compare &kcf = key_compare())
+        : m_header(NULL), m_data(NULL), m_levels(0), m_key_less(kcf)
+    {
+    }
+
+    /// Pack the key/data pairs of [ibegin, iend), which must be sorted by
+    /// key, usually the begin() and end() of a btree or btree_multimap. Any
+    /// previous contents are dropped.
+    template <typename Iterator>
+    void assign(Iterator ibegin, Iterator iend)
+    {
+        detach();
+
+        size_type n = std::distance(ibegin, iend);
+
+        // level sizes in blocks, then offsets of the arrays
+        std::vector<size_type> blocks;
+        for (size_type entries = n; entries > 0; )
+        {
+            blocks.push_back((entries + blockslots - 1) / blockslots);
+            if (blocks.back() == 1) break;
+            entries = blocks.back();
+        }
+
+        size_type off = align(sizeof(btree_frozen_header));
+        size_type dataoff = off;
+        off = align(off + n * sizeof(data_type));
+
+        std::vector<size_type> leveloff(blocks.size());
+        for (size_t l = 0; l < blocks.size(); ++l)
+        {
+            leveloff[l] = off;
+            off = align(off + blocks[l] * blockslots * sizeof(key_type));
+        }
+
+        m_storage.assign(off + alignment, 0);
+        char *base = &m_storage[0];
+        base += (alignment - reinterpret_cast<size_t>(base) % alignment) % alignment;
+
+        btree_frozen_header *header = reinterpret_cast<btree_frozen_header*>(base);
+        header->fill(sizeof(key_type), sizeof(data_type), blockslots);
+        header->itemcount = n;
+        header->size = off;
+
+        // level 0 and the data in one pass
+        data_type *datas = reinterpret_cast<data_type*>(base + dataoff);
+        key_type *keys = blocks.empty() ? NULL : reinterpret_cast<key_type*>(base + leveloff[0]);
+
+        size_type i = 0;
+        for (Iterator it = ibegin; it != iend; ++it, ++i)
+        {
+            keys[i] = it->first;
+            datas[i] = it->second;
+
+            BTREE_ASSERT(i == 0 || !m_key_less(keys[i], keys[i-1]));
+        }
+
+        // pad the last block of every level with its last key, then the
+        // level above takes the last key of each block
+        size_type entries = n;
+        for (size_t l = 0; l < blocks.size(); ++l)
+        {
+            keys = reinterpret_cast<key_type*>(base + leveloff[l]);
+
+            for (size_type j = entries; j < blocks[l] * blockslots; ++j)
+                keys[j] = keys[entries - 1];
+
+            if (l + 1 < blocks.size())
+            {
+                key_type *upper = reinterpret_cast<key_type*>(base + leveloff[l+1]);
+
+                for (size_type b = 0; b < blocks[l]; ++b)
+                    upper[b] = keys[b * blockslots + blockslots - 1];
+            }
+
+            entries = blocks[l];
+        }
+
+        size_type viewed = view(base, off);
+        BTREE_ASSERT(viewed == off);
+        (void)viewed;
+    }
+
+    /// Attach the container to the image at data, which may be followed by
+    /// other data up to size bytes. Returns the size of the image, or 0 if
+    /// the data does not contain an image of this instantiation, in which
+    /// case the container is left empty.
+    size_type attach(const char *data, size_type size)
+    {
+        detach();
+        return view(data, size);
+    }
+
+    /// Detach from the image and release an owned buffer, the container is
+    /// empty again.
+    void detach()
+    {
+        m_header = NULL;
+        m_data = NULL;
+        m_levels = 0;
+        std::vector<char>().swap(m_storage);
+    }
+
+    /// True if the container was built or attached
+    inline bool attached() const
+    {
+        return (m_header != NULL);
+    }
+
+    /// Write the image of the container, which can be attached to wherever
+    /// it is loaded at an aligned address.
+    void dump_image(std::ostream &os) const
+    {
+        if (!m_header)
+        {
+            self empty;
+            empty.assign(static_cast<const value_type*>(NULL), static_cast<const value_type*>(NULL));
+            empty.dump_image(os);
+            return;
+        }
+
+        os.write(reinterpret_cast<const char*>(m_header), static_cast<std::streamsize>(m_header->size));
+    }
+
+private:
+    /// Round an offset up to the alignment of the arrays
+    static inline size_type align(size_type off)
+    {
+        return (off + alignment - 1) / alignment * alignment;
+    }
+
+    /// Point the members into the image at data, used by attach() and by
+    /// assign() for the owned buffer. Returns the size of the image or 0.
+    size_type view(const char *data, size_type size)
+    {
+        if (size < sizeof(btree_frozen_header)) return 0;
+        if (reinterpret_cast<size_t>(data) % alignment != 0) return 0;
+
+        const btree_frozen_header *fileheader = reinterpret_cast<const btree_frozen_header*>(data);
+
+        btree_frozen_header myheader;
+        myheader.fill(sizeof(key_type), sizeof(data_type), blockslots);
+
+        if (!myheader.same(*fileheader) || fileheader->size > size)
+        {
+            BTREE_PRINT("btree_frozen::attach: image header does not match instantiation signature.");
+            return 0;
+        }
+
+        // recompute the layout of assign() and check it fits
+        size_type n = static_cast<size_type>(fileheader->itemcount);
+        size_type off = align(sizeof(btree_frozen_header));
+        const data_type *datas = reinterpret_cast<const data_type*>(data + off);
+        off = align(off + n * sizeof(data_type));
+
+        int levels = 0;
+        for (size_type entries = n; entries > 0; ++levels)
+        {
+            size_type blocks = (entries + blockslots - 1) / blockslots;
+            if (levels == maxlevels) return 0;
+
+            m_level[levels] = reinterpret_cast<const key_type*>(data + off);
+            off = align(off + blocks * blockslots * sizeof(key_type));
+
+            entries = (blocks == 1) ? 0 : blocks;
+        }
+
+        if (off != fileheader->size) return 0;
+
+        m_header = fileheader;
+        m_data = datas;
+        m_levels = levels;
+
+        return static_cast<size_type>(off);
+    }
+
+public:
+    // *** STL Iterator Construction Functions
+
+    /// Constructs a read-only constant iterator that points to the first pair
+    inline const_iterator begin() const
+    {
+        return const_iterator(leafkeys(), m_data, 0);
+    }
+
+    /// Constructs a read-only constant iterator that points behind the last
+    /// pair
+    inline const_iterator end() const
+    {
+        return const_iterator(leafkeys(), m_data, size());
+    }
+
+public:
+    // *** Access Functions to the Item Count
+
+    /// Return the number of key/data pairs
+    inline size_type size() const
+    {
+        return m_header ? static_cast<size_type>(m_header->itemcount) : 0;
+    }
+
+    /// Returns true if there is at least one key/data pair
+    inline bool empty() const
+    {
+        return (size() == size_type(0));
+    }
+
+    /// Return the number of levels of keys
+    inline int levels() const
+    {
+        return m_levels;
+    }
+
+    /// Size of the image in bytes, header and padding included
+    inline size_type byte_size() const
+    {
+        return m_header ? static_cast<size_type>(m_header->size) : 0;
+    }
+
+    /// Constant access to the key comparison object sorting the container
+    inline key_compare key_comp() const
+    {
+        return m_key_less;
+    }
+
+private:
+    // *** Search in the Levels
+
+    /// The level 0 keys, NULL if empty
+    inline const key_type* leafkeys() const
+    {
+        return m_levels ? m_level[0] : NULL;
+    }
+
+    /// True if a == b ? constructed from key_less(). This requires the <
+    /// relation to be a total order.
+    inline bool key_equal(const key_type &a, const key_type &b) const
+    {
+        return !m_key_less(a, b) && !m_key_less(b, a);
+    }
+
+    /// Intra-block search strategy, the same as the one of the btree.
+    typedef btree_node_search<key_type, key_compare, traits::binsearch_threshold> node_search;
+
+    /// Size of a block of keys in bytes
+    static const size_t blockbytes = blockslots * sizeof(key_type);
+
+    /// Search the block of keys for the first key greater or equal to key,
+    /// or greater than key if _Upper.
+    template <bool _Upper>
+    inline int find_slot(const key_type *block, const key_type &key) const
+    {
+        return _Upper
+            ? node_search::template upper<blockbytes>(block, blockslots, key, m_key_less)
+            : node_search::template lower<blockbytes>(block, blockslots, key, m_key_less);
+    }
+
+    /// Prefetch the cache lines of a block of keys
+    static inline void prefetch_block(const key_type *block)
+    {
+        const char *line = reinterpret_cast<const char*>(block);
+
+        for (size_t off = 0; off < blockbytes; off += 64)
+            BTREE_PREFETCH(line + off);
+    }
+
+    /// Position of the first key greater or equal to key, or greater than
+    /// key if _Upper. In an inner block only the padding of the last block
+    /// can leave every key less than key, then all keys are.
+    template <bool _Upper>
+    size_type search(const key_type &key) const
+    {
+        size_type pos = 0;
+
+        for (int l = m_levels - 1; l >= 0; --l)
+        {
+            int slot = find_slot<_Upper>(m_level[l] + pos * blockslots, key);
+
+            if (l > 0 && slot == blockslots) return size();
+            pos = pos * blockslots + slot;
+        }
+
+        return std::min(pos, size());
+    }
+
+    /// Search the n keys at keys[] level by level in lock-step. The block
+    /// every lookup continues with is prefetched as soon as it is computed,
+    /// like btree::multi_descend(). Writes the positions to pos[].
+    template <bool _Upper, typename ForwardIterator>
+    void multi_search(const ForwardIterator *keys, int n, size_type *pos) const
+    {
+        bool done[BTREE_BATCH_GROUP];
+
+        for (int i = 0; i < n; ++i)
+        {
+            pos[i] = 0;
+            done[i] = false;
+        }
+
+        for (int l = m_levels - 1; l >= 0; --l)
+        {
+            for (int i = 0; i < n; ++i)
+            {
+                if (done[i]) continue;
+
+                int slot = find_slot<_Upper>(m_level[l] + pos[i] * blockslots, *keys[i]);
+
+                if (l > 0 && slot == blockslots)
+                {
+                    pos[i] = size();
+                    done[i] = true;
+                    continue;
+                }
+
+                pos[i] = pos[i] * blockslots + slot;
+
+                if (l > 0)
+                    prefetch_block(m_level[l-1] + pos[i] * blockslots);
+            }
+        }
+
+        for (int i = 0; i < n; ++i)
+            pos[i] = std::min(pos[i], size());
+    }
+
+public:
+    // *** Standard Access Functions Querying the Levels
+
+    /// Non-STL function checking whether a key is in the container.
+    bool exists(const key_type &key) const
+    {
+        size_type pos = search<false>(key);
+        return (pos < size() && key_equal(key, leafkeys()[pos]));
+    }
+
+    /// Tries to locate a key and returns a constant iterator to the key/data
+    /// pair if found. If unsuccessful it returns end().
+    const_iterator find(const key_type &key) const
+    {
+        size_type pos = search<false>(key);
+        return (pos < size() && key_equal(key, leafkeys()[pos]))
+            ? const_iterator(leafkeys(), m_data, pos) : end();
+    }
+
+    /// Returns the number of identical key entries found.
+    size_type count(const key_type &key) const
+    {
+        return search<true>(key) - search<false>(key);
+    }
+
+    /// Returns a constant iterator to the first pair equal to or greater than
+    /// key, or end() if all keys are smaller.
+    const_iterator lower_bound(const key_type& key) const
+    {
+        return const_iterator(leafkeys(), m_data, search<false>(key));
+    }
+
+    /// Returns a constant iterator to the first pair greater than key, or
+    /// end() if all keys are smaller or equal.
+    const_iterator upper_bound(const key_type& key) const
+    {
+        return const_iterator(leafkeys(), m_data, search<true>(key));
+    }
+
+    /// Returns both lower_bound() and upper_bound().
+    inline std::pair<const_iterator, const_iterator> equal_range(const key_type& key) const
+    {
+        return std::pair<const_iterator, const_iterator>(lower_bound(key), upper_bound(key));
+    }
+
+public:
+    // *** Batched Access Functions Searching for Many Keys at Once
+
+    /// Writes lower_bound() of every key in [kbegin, kend) to out, in the
+    /// order of the keys. Groups of BTREE_BATCH_GROUP lookups search the
+    /// levels together with prefetching. Returns the end of the output.
+    template <typename ForwardIterator, typename OutputIterator>
+    OutputIterator multi_lower_bound(ForwardIterator kbegin, ForwardIterator kend, OutputIterator out) const
+    {
+        ForwardIterator keys[BTREE_BATCH_GROUP];
+        size_type pos[BTREE_BATCH_GROUP];
+
+        while (kbegin != kend)
+        {
+            int n = 0;
+            for (; n < BTREE_BATCH_GROUP && kbegin != kend; ++n, ++kbegin)
+                keys[n] = kbegin;
+
+            multi_search<false>(keys, n, pos);
+
+            for (int i = 0; i < n; ++i)
+                *out++ = const_iterator(leafkeys(), m_data, pos[i]);
+        }
+
+        return out;
+    }
+
+    /// Writes equal_range() of every key in [kbegin, kend) to out as pairs of
+    /// constant iterators, in the order of the keys. Returns the end of the
+    /// output.
+    template <typename ForwardIterator, typename OutputIterator>
+    OutputIterator multi_equal_range(ForwardIterator kbegin, ForwardIterator kend, OutputIterator out) const
+    {
+        ForwardIterator keys[BTREE_BATCH_GROUP];
+        size_type lower[BTREE_BATCH_GROUP], upper[BTREE_BATCH_GROUP];
+
+        while (kbegin != kend)
+        {
+            int n = 0;
+            for (; n < BTREE_BATCH_GROUP && kbegin != kend; ++n, ++kbegin)
+                keys[n] = kbegin;
+
+            multi_search<false>(keys, n, lower);
+            multi_search<true>(keys, n, upper);
+
+            for (int i = 0; i < n; ++i)
+            {
+                *out++ = std::make_pair(const_iterator(leafkeys(), m_data, lower[i]),
+                                        const_iterator(leafkeys(), m_data, upper[i]));
+            }
+        }
+
+        return out;
+    }
+};
+
+} // namespace stx
+
+#endif // _STX_BTREE_FROZEN_H_
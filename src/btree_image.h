@@ -0,0 +1,667 @@
+/** \file btree_image.h
+ * Contains the read-only B+ tree template class btree_image, which searches a
+ * pointer-free image written by btree::dump_image() in place.
+ */
+
+/*
+ * STX B+ Tree Template Classes v0.9
+ * Copyright (C) 2008-2013 Timo Bingmann
+ *
+ * Boost Software License - Version 1.0 - August 17th, 2003
+ *
+ * Permission is hereby granted, free of charge, to any person or organization
+ * obtaining a copy of the software and accompanying documentation covered by
+ * this license (the "Software") to use, reproduce, display, distribute,
+ * execute, and transmit the Software, and to prepare derivative works of the
+ * Software, and to permit third-parties to whom the Software is furnished to
+ * do so, all subject to the following:
+ *
+ * The copyright notices in the Software and this entire statement, including
+ * the above license grant, this restriction and the following disclaimer, must
+ * be included in all copies of the Software, in whole or in part, and all
+ * derivative works of the Software, unless such copies or derivative works are
+ * solely in the form of machine-executable object code generated by a source
+ * language processor.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+ * SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+ * FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _STX_BTREE_IMAGE_H_
+#define _STX_BTREE_IMAGE_H_
+
+#include "btree.h"
+
+namespace stx {
+
+/** @brief Read-only view of a B+ tree image.
+ *
+ * The image is produced by btree::dump_image() of a btree with the same
+ * template parameters. Instead of restoring the nodes onto the heap, the view
+ * is attached to the image wherever it lies in memory, usually a mmap() of
+ * the file, and descends the nodes by following their offsets. Attaching is
+ * O(1) and several processes mapping the same file share its pages through
+ * the page cache.
+ *
+ * The view does not own the memory, it must stay mapped while the view and
+ * its iterators are used.
+ */
+template <typename _Key, typename _Data,
+          typename _Compare = std::less<_Key>,
+          typename _Traits = btree_default_map_traits<_Key, _Data>,
+          bool _Duplicates = false>
+class btree_image
+{
+public:
+    // *** Template Parameter Types
+
+    /// First template parameter: The key type of the B+ tree. This is stored
+    /// in inner nodes and leaves
+    typedef _Key                        key_type;
+
+    /// Second template parameter: The data type associated with each
+    /// key. Stored in the B+ tree's leaves
+    typedef _Data                       data_type;
+
+    /// Third template parameter: Key comparison function object
+    typedef _Compare                    key_compare;
+
+    /// Fourth template parameter: Traits object used to define more parameters
+    /// of the B+ tree
+    typedef _Traits                     traits;
+
+    /// Fifth template parameter: Allow duplicate keys in the B+ tree.
+    static const bool                   allow_duplicates = _Duplicates;
+
+public:
+    // *** Constructed Types
+
+    /// Typedef of our own type
+    typedef btree_image<key_type, data_type, key_compare, traits, allow_duplicates> self;
+
+    /// Size type used to count keys
+    typedef size_t                              size_type;
+
+    /// The pair of key_type and data_type, returned by the iterators.
+    typedef std::pair<key_type, data_type>      value_type;
+
+    /// Base B+ tree parameter: The number of key/data slots in each leaf
+    static const unsigned short         leafslotmax =  traits::leafslots;
+
+    /// Base B+ tree parameter: The number of key slots in each inner node,
+    /// this can differ from slots in each leaf.
+    static const unsigned short         innerslotmax =  traits::innerslots;
+
+    /// Debug parameter: Prints out debug information. Requires the header
+    /// file to be compiled with BTREE_DEBUG.
+    static const bool                   debug = traits::debug;
+
+    /// Layout of the image, shared with btree::dump_image().
+    typedef btree_image_layout<key_type, data_type, leafslotmax, innerslotmax,
+                               allow_duplicates, false> layout;
+
+private:
+    // *** Node Types of the Image
+
+    typedef typename layout::offset_type        offset_type;
+    typedef typename layout::header             header;
+    typedef typename layout::node               node;
+    typedef typename layout::inner_node         inner_node;
+    typedef typename layout::leaf_node          leaf_node;
+
+public:
+    // *** Iterators
+
+    /// STL-like read-only iterator object for the image. The iterator points
+    /// to a specific slot number in a leaf of the image.
+    class const_iterator
+    {
+    public:
+        // *** Types
+
+        /// The key type of the btree. Returned by key().
+        typedef typename btree_image::key_type          key_type;
+
+        /// The data type of the btree. Returned by data().
+        typedef typename btree_image::data_type         data_type;
+
+        /// The value type of the btree. Returned by operator*().
+        typedef typename btree_image::value_type        value_type;
+
+        /// Reference to the value_type. STL required.
+        typedef const value_type&               reference;
+
+        /// Pointer to the value_type. STL required.
+        typedef const value_type*               pointer;
+
+        /// STL-magic iterator category
+        typedef std::bidirectional_iterator_tag         iterator_category;
+
+        /// STL-magic
+        typedef ptrdiff_t               difference_type;
+
+        /// Our own type
+        typedef const_iterator          self;
+
+    private:
+        // *** Members
+
+        /// Start of the image, base of all node offsets
+        const char*                     base;
+
+        /// The currently referenced leaf node of the image
+        const leaf_node*                currnode;
+
+        /// Current key/data slot referenced
+        unsigned short                  currslot;
+
+        /// Evil! A temporary value_type to STL-correctly deliver operator* and
+        /// operator->
+        mutable value_type              temp_value;
+
+    public:
+        // *** Methods
+
+        /// Default-Constructor of a const iterator
+        inline const_iterator()
+            : base(NULL), currnode(NULL), currslot(0)
+        { }
+
+        /// Initializing-Constructor of a const iterator
+        inline const_iterator(const char *b, const leaf_node *l, unsigned short s)
+            : base(b), currnode(l), currslot(s)
+        { }
+
+        /// Dereference the iterator. Do not use this if possible, use key()
+        /// and data() instead.
+        inline reference operator*() const
+        {
+            temp_value = value_type(key(), data());
+            return temp_value;
+        }
+
+        /// Dereference the iterator. Do not use this if possible, use key()
+        /// and data() instead.
+        inline pointer operator->() const
+        {
+            temp_value = value_type(key(), data());
+            return &temp_value;
+        }
+
+        /// Key of the current slot
+        inline const key_type& key() const
+        {
+            return currnode->slotkey[currslot];
+        }
+
+        /// Read-only reference to the current data object
+        inline const data_type& data() const
+        {
+            return currnode->slotdata[currslot];
+        }
+
+        /// Prefix++ advance the iterator to the next slot
+        inline self& operator++()
+        {
+            if (currslot + 1 < currnode->slotuse) {
+                ++currslot;
+            }
+            else if (currnode->nextleaf != 0) {
+                currnode = reinterpret_cast<const leaf_node*>(base + currnode->nextleaf);
+                currslot = 0;
+            }
+            else {
+                // this is end()
+                currslot = currnode->slotuse;
+            }
+
+            return *this;
+        }
+
+        /// Postfix++ advance the iterator to the next slot
+        inline self operator++(int)
+        {
+            self tmp = *this;   // copy ourselves
+            ++*this;
+            return tmp;
+        }
+
+        /// Prefix-- backstep the iterator to the last slot
+        inline self& operator--()
+        {
+            if (currslot > 0) {
+                --currslot;
+            }
+            else if (currnode->prevleaf != 0) {
+                currnode = reinterpret_cast<const leaf_node*>(base + currnode->prevleaf);
+                currslot = currnode->slotuse - 1;
+            }
+            else {
+                // this is begin()
+                currslot = 0;
+            }
+
+            return *this;
+        }
+
+        /// Postfix-- backstep the iterator to the last slot
+        inline self operator--(int)
+        {
+            self tmp = *this;   // copy ourselves
+            --*this;
+            return tmp;
+        }
+
+        /// Equality of iterators
+        inline bool operator==(const self& x) const
+        {
+            return (x.currnode == currnode) && (x.currslot == currslot);
+        }
+
+        /// Inequality of iterators
+        inline bool operator!=(const self& x) const
+        {
+            return (x.currnode != currnode) || (x.currslot != currslot);
+        }
+    };
+
+private:
+    // *** Image Object Data Members
+
+    /// Start of the attached image, NULL if not attached
+    const char*         m_base;
+
+    /// Header of the attached image
+    const header*       m_header;
+
+    /// Key comparison object. More comparison functions are generated from
+    /// this < relation.
+    key_compare         m_key_less;
+
+public:
+    // *** Constructors and Attaching
+
+    /// Default constructor initializing a view which is not attached to any
+    /// image, it behaves like an empty tree.
+    explicit inline btree_image(const key_compare &kcf = key_compare())
+        : m_base(NULL), m_header(NULL), m_key_less(kcf)
+    {
+    }
+
+    /// Attach the view to the image at data, which may be followed by other
+    /// data up to size bytes. Returns the size of the image, or 0 if the data
+    /// does not contain an image of this instantiation, in which case the
+    /// view is left detached.
+    size_type attach(const char *data, size_type size)
+    {
+        detach();
+
+        if (size < sizeof(header)) return 0;
+        if (reinterpret_cast<size_t>(data) % layout::alignment != 0) return 0;
+
+        const header *fileheader = reinterpret_cast<const header*>(data);
+
+        header myheader;
+        myheader.fill();
+
+        if (!myheader.same(*fileheader) || fileheader->size > size)
+        {
+            BTREE_PRINT("btree_image::attach: image header does not match instantiation signature.");
+            return 0;
+        }
+
+        if (fileheader->root >= fileheader->size ||
+            fileheader->headleaf >= fileheader->size ||
+            fileheader->tailleaf >= fileheader->size)
+        {
+            return 0;
+        }
+
+        m_base = data;
+        m_header = fileheader;
+
+        return static_cast<size_type>(fileheader->size);
+    }
+
+    /// Detach the view from its image, it behaves like an empty tree again.
+    void detach()
+    {
+        m_base = NULL;
+        m_header = NULL;
+    }
+
+    /// True if the view is attached to an image
+    inline bool attached() const
+    {
+        return (m_header != NULL);
+    }
+
+public:
+    // *** STL Iterator Construction Functions
+
+    /// Constructs a read-only constant iterator that points to the first slot
+    /// in the first leaf of the image.
+    inline const_iterator begin() const
+    {
+        return const_iterator(m_base, headleaf(), 0);
+    }
+
+    /// Constructs a read-only constant iterator that points to the first
+    /// invalid slot in the last leaf of the image.
+    inline const_iterator end() const
+    {
+        const leaf_node *tail = tailleaf();
+        return const_iterator(m_base, tail, tail ? tail->slotuse : 0);
+    }
+
+public:
+    // *** Access Functions to the Item Count
+
+    /// Return the number of key/data pairs in the image
+    inline size_type size() const
+    {
+        return m_header ? static_cast<size_type>(m_header->itemcount) : 0;
+    }
+
+    /// Returns true if there is at least one key/data pair in the image
+    inline bool empty() const
+    {
+        return (size() == size_type(0));
+    }
+
+    /// Return the number of leaves in the image
+    inline size_type leaves() const
+    {
+        return m_header ? static_cast<size_type>(m_header->leaves) : 0;
+    }
+
+    /// Return the number of inner nodes in the image
+    inline size_type innernodes() const
+    {
+        return m_header ? static_cast<size_type>(m_header->innernodes) : 0;
+    }
+
+    /// Constant access to the key comparison object sorting the image
+    inline key_compare key_comp() const
+    {
+        return m_key_less;
+    }
+
+private:
+    // *** Node Access by Offset
+
+    /// Node at the given offset of the image
+    template <typename node_type>
+    inline const node_type* node_at(offset_type off) const
+    {
+        return (off == 0) ? NULL : reinterpret_cast<const node_type*>(m_base + off);
+    }
+
+    /// The root node, NULL if not attached or empty
+    inline const node* root() const
+    {
+        return m_header ? node_at<node>(m_header->root) : NULL;
+    }
+
+    /// The first leaf, NULL if not attached or empty
+    inline const leaf_node* headleaf() const
+    {
+        return m_header ? node_at<leaf_node>(m_header->headleaf) : NULL;
+    }
+
+    /// The last leaf, NULL if not attached or empty
+    inline const leaf_node* tailleaf() const
+    {
+        return m_header ? node_at<leaf_node>(m_header->tailleaf) : NULL;
+    }
+
+    /// True if a == b ? constructed from key_less(). This requires the <
+    /// relation to be a total order, otherwise the B+ tree cannot be sorted.
+    inline bool key_equal(const key_type &a, const key_type &b) const
+    {
+        return !m_key_less(a, b) && !m_key_less(b, a);
+    }
+
+    /// Intra-node search strategy, the same as the one of the btree.
+    typedef btree_node_search<key_type, key_compare, traits::binsearch_threshold> node_search;
+
+    /// Searches for the first key in the node n greater or equal to key.
+    template <typename node_type>
+    inline int find_lower(const node_type *n, const key_type& key) const
+    {
+        return node_search::template lower<sizeof(n->slotkey)>(n->slotkey, n->slotuse, key, m_key_less);
+    }
+
+    /// Searches for the first key in the node n greater than key.
+    template <typename node_type>
+    inline int find_upper(const node_type *n, const key_type& key) const
+    {
+        return node_search::template upper<sizeof(n->slotkey)>(n->slotkey, n->slotuse, key, m_key_less);
+    }
+
+    /// Descend from the root to the leaf where key belongs, using find_lower()
+    /// or find_upper() on the inner nodes.
+    template <bool upper>
+    inline const leaf_node* descend(const key_type& key) const
+    {
+        const node *n = root();
+        if (!n) return NULL;
+
+        while (!n->isleafnode())
+        {
+            const inner_node *inner = static_cast<const inner_node*>(n);
+            int slot = upper ? find_upper(inner, key) : find_lower(inner, key);
+
+            n = node_at<node>(inner->childid[slot]);
+        }
+
+        return static_cast<const leaf_node*>(n);
+    }
+
+public:
+    // *** Standard Access Functions Querying the Image by Descending to a Leaf
+
+    /// Non-STL function checking whether a key is in the image. The same as
+    /// (find(k) != end()) or (count() != 0).
+    bool exists(const key_type &key) const
+    {
+        const leaf_node *leaf = descend<false>(key);
+        if (!leaf) return false;
+
+        int slot = find_lower(leaf, key);
+        return (slot < leaf->slotuse && key_equal(key, leaf->slotkey[slot]));
+    }
+
+    /// Tries to locate a key in the image and returns a constant iterator to
+    /// the key/data slot if found. If unsuccessful it returns end().
+    const_iterator find(const key_type &key) const
+    {
+        const leaf_node *leaf = descend<false>(key);
+        if (!leaf) return end();
+
+        int slot = find_lower(leaf, key);
+        return (slot < leaf->slotuse && key_equal(key, leaf->slotkey[slot]))
+            ? const_iterator(m_base, leaf, slot) : end();
+    }
+
+    /// Tries to locate a key in the image and returns the number of identical
+    /// key entries found.
+    size_type count(const key_type &key) const
+    {
+        const leaf_node *leaf = descend<false>(key);
+        if (!leaf) return 0;
+
+        int slot = find_lower(leaf, key);
+        size_type num = 0;
+
+        while (leaf && slot < leaf->slotuse && key_equal(key, leaf->slotkey[slot]))
+        {
+            ++num;
+            if (++slot >= leaf->slotuse)
+            {
+                leaf = node_at<leaf_node>(leaf->nextleaf);
+                slot = 0;
+            }
+        }
+
+        return num;
+    }
+
+    /// Searches the image and returns a constant iterator to the first pair
+    /// equal to or greater than key, or end() if all keys are smaller.
+    const_iterator lower_bound(const key_type& key) const
+    {
+        const leaf_node *leaf = descend<false>(key);
+        if (!leaf) return end();
+
+        return const_iterator(m_base, leaf, find_lower(leaf, key));
+    }
+
+    /// Searches the image and returns a constant iterator to the first pair
+    /// greater than key, or end() if all keys are smaller or equal.
+    const_iterator upper_bound(const key_type& key) const
+    {
+        const leaf_node *leaf = descend<true>(key);
+        if (!leaf) return end();
+
+        return const_iterator(m_base, leaf, find_upper(leaf, key));
+    }
+
+    /// Searches the image and returns both lower_bound() and upper_bound().
+    inline std::pair<const_iterator, const_iterator> equal_range(const key_type& key) const
+    {
+        return std::pair<const_iterator, const_iterator>(lower_bound(key), upper_bound(key));
+    }
+
+private:
+    // *** Batched Descent of Many Keys
+
+    /// Prefetch the cache lines of node n up to the end of its keys.
+    template <typename node_type>
+    static inline void prefetch_keys(const node_type *n)
+    {
+        const char *line = reinterpret_cast<const char*>(n);
+        const char *end = reinterpret_cast<const char*>(n->slotkey + sizeof(n->slotkey) / sizeof(key_type));
+
+        for (; line < end; line += 64)
+            BTREE_PREFETCH(line);
+    }
+
+    /// Descend with the n keys at keys[] to their leaves in lock-step, the
+    /// same as btree::multi_descend() but following offsets.
+    template <bool _Upper, typename ForwardIterator>
+    void multi_descend(const ForwardIterator *keys, int n, const leaf_node **leaf, unsigned short *slot) const
+    {
+        const node *cur[BTREE_BATCH_GROUP];
+        const node *rootnode = root();
+
+        if (!rootnode)
+        {
+            for (int i = 0; i < n; ++i)
+            {
+                leaf[i] = tailleaf();
+                slot[i] = 0;
+            }
+            return;
+        }
+
+        for (int i = 0; i < n; ++i)
+            cur[i] = rootnode;
+
+        for (unsigned short level = rootnode->level; level > 0; --level)
+        {
+            for (int i = 0; i < n; ++i)
+            {
+                const inner_node *inner = static_cast<const inner_node*>(cur[i]);
+                int s = _Upper ? find_upper(inner, *keys[i]) : find_lower(inner, *keys[i]);
+
+                cur[i] = node_at<node>(inner->childid[s]);
+
+                if (level > 1)
+                    prefetch_keys(static_cast<const inner_node*>(cur[i]));
+                else
+                    prefetch_keys(static_cast<const leaf_node*>(cur[i]));
+            }
+        }
+
+        for (int i = 0; i < n; ++i)
+        {
+            leaf[i] = static_cast<const leaf_node*>(cur[i]);
+            slot[i] = _Upper ? find_upper(leaf[i], *keys[i]) : find_lower(leaf[i], *keys[i]);
+
+            // the bound behind the last slot of a leaf is the first slot of
+            // the next one, as in btree::multi_descend().
+            if (slot[i] == leaf[i]->slotuse && leaf[i]->nextleaf)
+            {
+                leaf[i] = node_at<leaf_node>(leaf[i]->nextleaf);
+                slot[i] = 0;
+            }
+        }
+    }
+
+public:
+    // *** Batched Access Functions Descending for Many Keys at Once
+
+    /// Writes lower_bound() of every key in [kbegin, kend) to out, in the
+    /// order of the keys. Groups of BTREE_BATCH_GROUP lookups descend the
+    /// image together with prefetching. Returns the end of the output.
+    template <typename ForwardIterator, typename OutputIterator>
+    OutputIterator multi_lower_bound(ForwardIterator kbegin, ForwardIterator kend, OutputIterator out) const
+    {
+        ForwardIterator keys[BTREE_BATCH_GROUP];
+        const leaf_node *leaf[BTREE_BATCH_GROUP];
+        unsigned short slot[BTREE_BATCH_GROUP];
+
+        while (kbegin != kend)
+        {
+            int n = 0;
+            for (; n < BTREE_BATCH_GROUP && kbegin != kend; ++n, ++kbegin)
+                keys[n] = kbegin;
+
+            multi_descend<false>(keys, n, leaf, slot);
+
+            for (int i = 0; i < n; ++i)
+                *out++ = const_iterator(m_base, leaf[i], slot[i]);
+        }
+
+        return out;
+    }
+
+    /// Writes equal_range() of every key in [kbegin, kend) to out as pairs of
+    /// constant iterators, in the order of the keys. Returns the end of the
+    /// output.
+    template <typename ForwardIterator, typename OutputIterator>
+    OutputIterator multi_equal_range(ForwardIterator kbegin, ForwardIterator kend, OutputIterator out) const
+    {
+        ForwardIterator keys[BTREE_BATCH_GROUP];
+        const leaf_node *lowerleaf[BTREE_BATCH_GROUP], *upperleaf[BTREE_BATCH_GROUP];
+        unsigned short lowerslot[BTREE_BATCH_GROUP], upperslot[BTREE_BATCH_GROUP];
+
+        while (kbegin != kend)
+        {
+            int n = 0;
+            for (; n < BTREE_BATCH_GROUP && kbegin != kend; ++n, ++kbegin)
+                keys[n] = kbegin;
+
+            multi_descend<false>(keys, n, lowerleaf, lowerslot);
+            multi_descend<true>(keys, n, upperleaf, upperslot);
+
+            for (int i = 0; i < n; ++i)
+            {
+                *out++ = std::make_pair(const_iterator(m_base, lowerleaf[i], lowerslot[i]),
+                                        const_iterator(m_base, upperleaf[i], upperslot[i]));
+            }
+        }
+
+        return out;
+    }
+};
+
+} // namespace stx
+
+#endif // _STX_BTREE_IMAGE_H_
@@ -35,6 +35,7 @@
 #define _STX_BTREE_MULTIMAP_H_
 
 #include "btree.h"
+#include "btree_image.h"
 
 namespace stx {
 
@@ -157,6 +158,9 @@ public:
     /// create constant reverse iterator by using STL magic
     typedef typename btree_impl::const_reverse_iterator const_reverse_iterator;
 
+    /// Read-only view searching an image written by dump_image() in place
+    typedef btree_image<key_type, data_type, key_compare, traits, true> image_type;
+
 private:
     // *** Tree Implementation Object
 
@@ -403,6 +407,42 @@ public:
         return tree.equal_range(key);
     }
 
+public:
+    // *** Batched Access Functions Descending for Many Keys at Once
+
+    /// Writes lower_bound() of every key in [kbegin, kend) to out, in the
+    /// order of the keys. Groups of lookups descend the tree together with
+    /// prefetching.
+    template <typename ForwardIterator, typename OutputIterator>
+    OutputIterator multi_lower_bound(ForwardIterator kbegin, ForwardIterator kend, OutputIterator out)
+    {
+        return tree.multi_lower_bound(kbegin, kend, out);
+    }
+
+    /// Writes lower_bound() of every key in [kbegin, kend) to out as constant
+    /// iterators.
+    template <typename ForwardIterator, typename OutputIterator>
+    OutputIterator multi_lower_bound(ForwardIterator kbegin, ForwardIterator kend, OutputIterator out) const
+    {
+        return tree.multi_lower_bound(kbegin, kend, out);
+    }
+
+    /// Writes equal_range() of every key in [kbegin, kend) to out as pairs of
+    /// iterators, in the order of the keys.
+    template <typename ForwardIterator, typename OutputIterator>
+    OutputIterator multi_equal_range(ForwardIterator kbegin, ForwardIterator kend, OutputIterator out)
+    {
+        return tree.multi_equal_range(kbegin, kend, out);
+    }
+
+    /// Writes equal_range() of every key in [kbegin, kend) to out as pairs of
+    /// constant iterators.
+    template <typename ForwardIterator, typename OutputIterator>
+    OutputIterator multi_equal_range(ForwardIterator kbegin, ForwardIterator kend, OutputIterator out) const
+    {
+        return tree.multi_equal_range(kbegin, kend, out);
+    }
+
 public:
     // *** B+ Tree Object Comparison Functions
 
@@ -492,15 +532,17 @@ public:
         return tree.insert2(key, data).first;
     }
 
-    /// Attempt to insert a key/data pair into the B+ tree. The iterator hint
-    /// is currently ignored by the B+ tree insertion routine.
+    /// Attempt to insert a key/data pair into the B+ tree. If the key belongs
+    /// into the hint's leaf or the last leaf and that has a free slot, the
+    /// pair is put there without descending from the root.
     inline iterator insert(iterator hint, const value_type &x)
     {
         return tree.insert2(hint, x.first, x.second);
     }
 
-    /// Attempt to insert a key/data pair into the B+ tree. The iterator hint is
-    /// currently ignored by the B+ tree insertion routine.
+    /// Attempt to insert a key/data pair into the B+ tree. If the key belongs
+    /// into the hint's leaf or the last leaf and that has a free slot, the
+    /// pair is put there without descending from the root.
     inline iterator insert2(iterator hint, const key_type& key, const data_type& data)
     {
         return tree.insert2(hint, key, data);
@@ -523,6 +565,15 @@ public:
         return tree.bulk_load(first, last);
     }
 
+    /// Insert a sorted range [first,last) into the tree, which may already
+    /// hold items. The range is merged into the leaves from left to right,
+    /// with one visit of each touched node instead of one descent per item.
+    template <typename Iterator>
+    inline void insert_sorted(Iterator first, Iterator last)
+    {
+        return tree.insert_sorted(first, last);
+    }
+
 public:
     // *** Public Erase Functions
 
@@ -546,14 +597,12 @@ public:
         return tree.erase(iter);
     }
 
-#ifdef BTREE_TODO
-    /// Erase all key/data pairs in the range [first,last). This function is
-    /// currently not implemented by the B+ Tree.
-    void erase(iterator /* first */, iterator /* last */)
+    /// Erase all key/data pairs in the range [first,last). Whole leaves and
+    /// subtrees inside the range are freed without visiting their items.
+    void erase(iterator first, iterator last)
     {
-        abort();
+        return tree.erase(first, last);
     }
-#endif
 
 #ifdef BTREE_DEBUG
 public:
@@ -603,6 +652,15 @@ public:
     {
         return tree.restore(is);
     }
+
+    /// Dump the B+ tree onto an ostream as a pointer-free image, which can be
+    /// searched in place by an image_type attached to it. For this to work
+    /// your key_type and data_type must be integral types and contain no
+    /// pointers or references.
+    void dump_image(std::ostream &os) const
+    {
+        tree.dump_image(os);
+    }
 };
 
 } // namespace stx
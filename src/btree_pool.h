@@ -0,0 +1,338 @@
+/** \file btree_pool.h
+ * Contains the node allocator btree_pool_allocator, which carves the nodes of
+ * a B+ tree out of large slabs.
+ */
+
+/*
+ * STX B+ Tree Template Classes v0.9
+ * Copyright (C) 2008-2013 Timo Bingmann
+ *
+ * Boost Software License - Version 1.0 - August 17th, 2003
+ *
+ * Permission is hereby granted, free of charge, to any person or organization
+ * obtaining a copy of the software and accompanying documentation covered by
+ * this license (the "Software") to use, reproduce, display, distribute,
+ * execute, and transmit the Software, and to prepare derivative works of the
+ * Software, and to permit third-parties to whom the Software is furnished to
+ * do so, all subject to the following:
+ *
+ * The copyright notices in the Software and this entire statement, including
+ * the above license grant, this restriction and the following disclaimer, must
+ * be included in all copies of the Software, in whole or in part, and all
+ * derivative works of the Software, unless such copies or derivative works are
+ * solely in the form of machine-executable object code generated by a source
+ * language processor.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+ * SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+ * FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _STX_BTREE_POOL_H_
+#define _STX_BTREE_POOL_H_
+
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include <memory>
+#include <sys/mman.h>
+
+#include "btree.h"
+
+namespace stx {
+
+/** @brief Pool of fixed size node objects carved out of large slabs.
+ *
+ * Each object size gets its own slabs, so leaves and inner nodes each lie
+ * densely packed next to each other. Freed objects are kept on a free list of
+ * their size and reused. The slabs are aligned to and sized as a huge page, so
+ * the kernel can back them by huge pages. All slabs are only returned at once
+ * by release(). The pool is not thread-safe.
+ */
+class btree_node_pool
+{
+public:
+    /// Size and alignment of each slab, one huge page on x86-64
+    static const size_t slab_size = 2 * 1024 * 1024;
+
+private:
+    /// Free list link stored in a freed object
+    struct free_object
+    {
+        free_object     *next;
+    };
+
+    /// Objects of one size
+    struct size_class
+    {
+        /// Size of each object, rounded up to the alignment
+        size_t          size;
+
+        /// Freed objects of this size
+        free_object     *freelist;
+
+        /// Unused space in the current slab of this size
+        char            *current, *end;
+    };
+
+    /// Alignment of each object
+    static const size_t alignment = sizeof(void*) > sizeof(double) ? sizeof(void*) : sizeof(double);
+
+    /// The size classes, there are only few of them
+    std::vector<size_class>     m_classes;
+
+    /// All slabs allocated by this pool
+    std::vector<void*>          m_slabs;
+
+private:
+    /// Non-copyable
+    btree_node_pool(const btree_node_pool &);
+
+    /// Non-copyable
+    btree_node_pool& operator=(const btree_node_pool &);
+
+public:
+    /// Create an empty pool
+    btree_node_pool()
+    { }
+
+    /// Frees all slabs
+    ~btree_node_pool()
+    {
+        release();
+    }
+
+    /// Allocate one object of the given size. Objects larger than a slab are
+    /// left to operator new.
+    void* allocate(size_t size)
+    {
+        size = (size + alignment - 1) / alignment * alignment;
+        if (size > slab_size) return ::operator new(size);
+
+        size_class &c = get_class(size);
+
+        if (c.freelist)
+        {
+            free_object *o = c.freelist;
+            c.freelist = o->next;
+            return o;
+        }
+
+        if (c.current + size > c.end)
+        {
+            c.current = static_cast<char*>(allocate_slab());
+            c.end = c.current + slab_size / size * size;
+        }
+
+        void *p = c.current;
+        c.current += size;
+        return p;
+    }
+
+    /// Return an object of the given size to the pool
+    void deallocate(void *p, size_t size)
+    {
+        size = (size + alignment - 1) / alignment * alignment;
+        if (size > slab_size) return ::operator delete(p);
+
+        size_class &c = get_class(size);
+
+        free_object *o = static_cast<free_object*>(p);
+        o->next = c.freelist;
+        c.freelist = o;
+    }
+
+    /// Free all slabs at once. All objects allocated from the pool must have
+    /// been destroyed.
+    void release()
+    {
+        for (size_t i = 0; i < m_slabs.size(); ++i)
+            std::free(m_slabs[i]);
+
+        m_slabs.clear();
+        m_classes.clear();
+    }
+
+    /// Number of slabs currently allocated
+    size_t slabs() const
+    {
+        return m_slabs.size();
+    }
+
+private:
+    /// Find or create the size class of the given size
+    size_class& get_class(size_t size)
+    {
+        for (size_t i = 0; i < m_classes.size(); ++i)
+        {
+            if (m_classes[i].size == size) return m_classes[i];
+        }
+
+        size_class c = { size, NULL, NULL, NULL };
+        m_classes.push_back(c);
+        return m_classes.back();
+    }
+
+    /// Allocate a new slab aligned to its size and advise the kernel to use a
+    /// huge page for it.
+    void* allocate_slab()
+    {
+        m_slabs.reserve(m_slabs.size() + 1);
+
+        void *slab = NULL;
+        if (posix_memalign(&slab, slab_size, slab_size) != 0)
+            throw std::bad_alloc();
+
+#ifdef MADV_HUGEPAGE
+        madvise(slab, slab_size, MADV_HUGEPAGE);
+#endif
+
+        m_slabs.push_back(slab);
+        return slab;
+    }
+};
+
+/** @brief STL allocator drawing the B+ tree nodes from a btree_node_pool.
+ *
+ * Copies of the allocator, including the rebound node allocators of a btree,
+ * share the same pool. A default constructed allocator creates a new pool, so
+ * each tree has its own pool unless an allocator is passed explicitly. When
+ * the tree is cleared and no other tree shares its pool, all slabs are
+ * released at once instead of being kept for reuse.
+ */
+template <typename _Type>
+class btree_pool_allocator
+{
+public:
+    // *** STL Allocator Types
+
+    typedef _Type               value_type;
+    typedef _Type*              pointer;
+    typedef const _Type*        const_pointer;
+    typedef _Type&              reference;
+    typedef const _Type&        const_reference;
+    typedef size_t              size_type;
+    typedef ptrdiff_t           difference_type;
+
+    /// The same allocator for another type, sharing the pool
+    template <typename _Other>
+    struct rebind
+    {
+        typedef btree_pool_allocator<_Other> other;
+    };
+
+private:
+    /// The shared pool
+    std::shared_ptr<btree_node_pool>    m_pool;
+
+    template <typename _Other> friend class btree_pool_allocator;
+
+public:
+    /// Create an allocator with a new pool
+    btree_pool_allocator()
+        : m_pool(new btree_node_pool)
+    { }
+
+    /// Create an allocator sharing the pool of other
+    template <typename _Other>
+    btree_pool_allocator(const btree_pool_allocator<_Other> &other)
+        : m_pool(other.m_pool)
+    { }
+
+    /// Allocate n objects. Single objects, i.e. nodes, come from the pool.
+    pointer allocate(size_type n, const void * = 0)
+    {
+        if (n == 1)
+            return static_cast<pointer>(m_pool->allocate(sizeof(_Type)));
+        else
+            return static_cast<pointer>(::operator new(n * sizeof(_Type)));
+    }
+
+    /// Deallocate n objects allocated by allocate()
+    void deallocate(pointer p, size_type n)
+    {
+        if (n == 1)
+            m_pool->deallocate(p, sizeof(_Type));
+        else
+            ::operator delete(p);
+    }
+
+    /// Construct an object at p
+    void construct(pointer p, const_reference val)
+    {
+        new (p) _Type(val);
+    }
+
+    /// Destroy the object at p
+    void destroy(pointer p)
+    {
+        p->~_Type();
+    }
+
+    /// Address of an object
+    pointer address(reference x) const
+    {
+        return &x;
+    }
+
+    /// Address of an object
+    const_pointer address(const_reference x) const
+    {
+        return &x;
+    }
+
+    /// Maximum number of objects which can be allocated
+    size_type max_size() const
+    {
+        return size_type(-1) / sizeof(_Type);
+    }
+
+    /// Release all slabs of the pool if no other allocator shares it. All
+    /// objects allocated from it must have been destroyed.
+    bool release()
+    {
+        if (!m_pool.unique()) return false;
+
+        m_pool->release();
+        return true;
+    }
+
+    /// The shared pool
+    const btree_node_pool& pool() const
+    {
+        return *m_pool;
+    }
+
+    /// Allocators are equal if they share the pool
+    template <typename _Other>
+    bool operator==(const btree_pool_allocator<_Other> &other) const
+    {
+        return m_pool == other.m_pool;
+    }
+
+    /// Allocators are equal if they share the pool
+    template <typename _Other>
+    bool operator!=(const btree_pool_allocator<_Other> &other) const
+    {
+        return m_pool != other.m_pool;
+    }
+};
+
+/// Release the slabs of a cleared B+ tree, see btree_pool_allocator.
+template <typename _Type>
+struct btree_allocator_release< btree_pool_allocator<_Type> >
+{
+    /// Release the slabs if the pool isn't shared
+    static inline void release(btree_pool_allocator<_Type> &alloc)
+    {
+        alloc.release();
+    }
+};
+
+} // namespace stx
+
+#endif // _STX_BTREE_POOL_H_
@@ -0,0 +1,693 @@
+/** \file btree_posting.h
+ * Contains the multimap variant btree_posting_multimap, which keeps the values
+ * of each key as one compressed posting list, and its read-only image view.
+ */
+
+/*
+ * STX B+ Tree Template Classes v0.9
+ * Copyright (C) 2008-2013 Timo Bingmann
+ *
+ * Boost Software License - Version 1.0 - August 17th, 2003
+ *
+ * Permission is hereby granted, free of charge, to any person or organization
+ * obtaining a copy of the software and accompanying documentation covered by
+ * this license (the "Software") to use, reproduce, display, distribute,
+ * execute, and transmit the Software, and to prepare derivative works of the
+ * Software, and to permit third-parties to whom the Software is furnished to
+ * do so, all subject to the following:
+ *
+ * The copyright notices in the Software and this entire statement, including
+ * the above license grant, this restriction and the following disclaimer, must
+ * be included in all copies of the Software, in whole or in part, and all
+ * derivative works of the Software, unless such copies or derivative works are
+ * solely in the form of machine-executable object code generated by a source
+ * language processor.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+ * SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+ * FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _STX_BTREE_POSTING_H_
+#define _STX_BTREE_POSTING_H_
+
+#include <vector>
+#include <ostream>
+
+#include "btree.h"
+#include "btree_image.h"
+
+namespace stx {
+
+/// Location of the posting list of a key among the encoded values of a
+/// btree_posting_multimap. This is the data type of its key tree.
+struct btree_posting_ref
+{
+    /// Byte offset of the first encoded value
+    unsigned long long  offset;
+
+    /// Number of values in the list
+    unsigned long long  count;
+};
+
+/** @brief Ascending values of a key, encoded as deltas in varints.
+ *
+ * Each value is stored as the difference to the one before, the first as is,
+ * in seven bit groups with the high bit of each byte marking that another
+ * group follows. Runs of nearby offsets thus take one or two bytes per value
+ * instead of a full key/data slot. The list does not own its bytes, it is
+ * only valid while the multimap or the mapped image is.
+ */
+template <typename _Data>
+class btree_posting_list
+{
+public:
+    /// The values of the list, an unsigned integral type
+    typedef _Data       data_type;
+
+    /// Size type used to count values
+    typedef size_t      size_type;
+
+    /// STL-like forward iterator decoding the values one by one.
+    class const_iterator
+    {
+    public:
+        // *** Types
+
+        /// STL-magic iterator category
+        typedef std::forward_iterator_tag       iterator_category;
+
+        /// The value type of the list
+        typedef data_type                       value_type;
+
+        /// STL-magic
+        typedef ptrdiff_t                       difference_type;
+
+        /// Reference to the decoded value
+        typedef const data_type&                reference;
+
+        /// Pointer to the decoded value
+        typedef const data_type*                pointer;
+
+    private:
+        // *** Members
+
+        /// The next byte to decode
+        const unsigned char     *ptr;
+
+        /// Number of values left including the current one
+        size_type               left;
+
+        /// The current value
+        data_type               value;
+
+    public:
+        // *** Methods
+
+        /// Default-Constructor of an end iterator
+        inline const_iterator()
+            : ptr(NULL), left(0), value()
+        { }
+
+        /// Initializing-Constructor decoding the first of left values at p
+        inline const_iterator(const unsigned char *p, size_type l)
+            : ptr(p), left(l), value()
+        {
+            if (left) value = decode(ptr);
+        }
+
+        /// Dereference the iterator
+        inline reference operator*() const
+        {
+            return value;
+        }
+
+        /// Dereference the iterator
+        inline pointer operator->() const
+        {
+            return &value;
+        }
+
+        /// Prefix++ advance the iterator to the next value
+        inline const_iterator& operator++()
+        {
+            if (--left) value += decode(ptr);
+            return *this;
+        }
+
+        /// Postfix++ advance the iterator to the next value
+        inline const_iterator operator++(int)
+        {
+            const_iterator tmp = *this;
+            ++*this;
+            return tmp;
+        }
+
+        /// Equality of iterators of the same list
+        inline bool operator==(const const_iterator& x) const
+        {
+            return (x.left == left);
+        }
+
+        /// Inequality of iterators of the same list
+        inline bool operator!=(const const_iterator& x) const
+        {
+            return (x.left != left);
+        }
+    };
+
+private:
+    // *** Members
+
+    /// The first encoded value
+    const unsigned char *m_data;
+
+    /// Number of values
+    size_type           m_size;
+
+public:
+    // *** Constructors
+
+    /// Default constructor of an empty list
+    inline btree_posting_list()
+        : m_data(NULL), m_size(0)
+    { }
+
+    /// Constructor of the list of size values encoded at data
+    inline btree_posting_list(const unsigned char *data, size_type size)
+        : m_data(data), m_size(size)
+    { }
+
+    /// Iterator to the first value
+    inline const_iterator begin() const
+    {
+        return const_iterator(m_data, m_size);
+    }
+
+    /// Iterator past the last value
+    inline const_iterator end() const
+    {
+        return const_iterator();
+    }
+
+    /// Number of values in the list
+    inline size_type size() const
+    {
+        return m_size;
+    }
+
+    /// True if the list has no values
+    inline bool empty() const
+    {
+        return (m_size == 0);
+    }
+
+public:
+    // *** Encoding
+
+    /// Append the encoding of a delta to bytes.
+    static inline void encode(std::vector<unsigned char> &bytes, data_type delta)
+    {
+        while (delta >= 0x80)
+        {
+            bytes.push_back(static_cast<unsigned char>(delta | 0x80));
+            delta >>= 7;
+        }
+        bytes.push_back(static_cast<unsigned char>(delta));
+    }
+
+    /// Decode the delta at ptr and advance ptr past it.
+    static inline data_type decode(const unsigned char *&ptr)
+    {
+        data_type delta = *ptr & 0x7F;
+
+        for (unsigned int shift = 7; *ptr++ & 0x80; shift += 7)
+            delta |= static_cast<data_type>(*ptr & 0x7F) << shift;
+
+        return delta;
+    }
+};
+
+/** Header in front of the image of a btree_posting_multimap. The key tree's
+ * image follows at the next aligned offset, then the encoded values. */
+struct btree_posting_header
+{
+    /// "stx-posting", just to stop attach() from using garbage
+    char                signature[12];
+
+    /// Currently 0
+    unsigned short      version;
+
+    /// sizeof(data_type)
+    unsigned short      data_type_size;
+
+    /// Number of values
+    unsigned long long  itemcount;
+
+    /// Size of the encoded values in bytes
+    unsigned long long  bytes;
+
+    /// Fill the struct with the properties of the instantiation, the counts
+    /// are not filled.
+    inline void fill(unsigned short datasize)
+    {
+        std::fill_n(reinterpret_cast<char*>(this), sizeof(*this), 0);
+        std::copy("stx-posting", "stx-posting" + 11, signature);
+        version = 0;
+        data_type_size = datasize;
+    }
+
+    /// Returns true if the headers have the same vital properties
+    inline bool same(const btree_posting_header &o) const
+    {
+        return std::equal(signature, signature + 12, o.signature)
+            && (version == o.version)
+            && (data_type_size == o.data_type_size);
+    }
+};
+
+/** @brief Read-only view of a btree_posting_multimap image.
+ *
+ * The image is produced by btree_posting_multimap::dump_image() of a multimap
+ * with the same template parameters. Like btree_image the view searches the
+ * image in place, the posting lists it returns point into the image.
+ */
+template <typename _Key, typename _Data,
+          typename _Compare = std::less<_Key>,
+          typename _Traits = btree_default_map_traits<_Key, btree_posting_ref> >
+class btree_posting_image
+{
+public:
+    // *** Template Parameter Types
+
+    /// First template parameter: The key type
+    typedef _Key                        key_type;
+
+    /// Second template parameter: The values of the posting lists, an
+    /// unsigned integral type
+    typedef _Data                       data_type;
+
+    /// Third template parameter: Key comparison function object
+    typedef _Compare                    key_compare;
+
+    /// Fourth template parameter: Traits object of the key tree
+    typedef _Traits                     traits;
+
+    /// Size type used to count values
+    typedef size_t                      size_type;
+
+    /// The posting list of a key
+    typedef btree_posting_list<data_type>   posting_list;
+
+    /// View of the key tree's image
+    typedef btree_image<key_type, btree_posting_ref, key_compare, traits, false> tree_image;
+
+private:
+    // *** Members
+
+    /// Header of the attached image, NULL if not attached
+    const btree_posting_header  *m_header;
+
+    /// View of the key tree
+    tree_image                  m_keys;
+
+    /// The encoded values
+    const unsigned char         *m_bytes;
+
+public:
+    // *** Constructors and Attaching
+
+    /// Default constructor initializing a view which is not attached to any
+    /// image, it behaves like an empty multimap.
+    explicit inline btree_posting_image(const key_compare &kcf = key_compare())
+        : m_header(NULL), m_keys(kcf), m_bytes(NULL)
+    {
+    }
+
+    /// Attach the view to the image at data, which may be followed by other
+    /// data up to size bytes. Returns the size of the image, or 0 if the data
+    /// does not contain an image of this instantiation.
+    size_type attach(const char *data, size_type size)
+    {
+        detach();
+
+        typedef typename tree_image::layout layout;
+
+        if (size < sizeof(btree_posting_header)) return 0;
+        if (reinterpret_cast<size_t>(data) % layout::alignment != 0) return 0;
+
+        const btree_posting_header *fileheader = reinterpret_cast<const btree_posting_header*>(data);
+
+        btree_posting_header myheader;
+        myheader.fill(sizeof(data_type));
+
+        if (!myheader.same(*fileheader)) return 0;
+
+        size_type off = layout::align(sizeof(btree_posting_header));
+        if (off >= size) return 0;
+
+        size_type keysize = m_keys.attach(data + off, size - off);
+        if (keysize == 0 || fileheader->bytes > size - off - keysize)
+        {
+            m_keys.detach();
+            return 0;
+        }
+
+        m_header = fileheader;
+        m_bytes = reinterpret_cast<const unsigned char*>(data + off + keysize);
+
+        return static_cast<size_type>(off + keysize + fileheader->bytes);
+    }
+
+    /// Detach the view from its image, it behaves like an empty multimap again.
+    void detach()
+    {
+        m_header = NULL;
+        m_keys.detach();
+        m_bytes = NULL;
+    }
+
+    /// True if the view is attached to an image
+    inline bool attached() const
+    {
+        return (m_header != NULL);
+    }
+
+public:
+    // *** Access Functions
+
+    /// Number of values in the image
+    inline size_type size() const
+    {
+        return m_header ? static_cast<size_type>(m_header->itemcount) : 0;
+    }
+
+    /// Number of distinct keys in the image
+    inline size_type key_count() const
+    {
+        return m_keys.size();
+    }
+
+    /// Number of values of the key
+    size_type count(const key_type &key) const
+    {
+        typename tree_image::const_iterator it = m_keys.find(key);
+        return (it == m_keys.end()) ? 0 : static_cast<size_type>(it->second.count);
+    }
+
+    /// The posting list of the key, empty if the key is not present
+    posting_list equal_range(const key_type &key) const
+    {
+        typename tree_image::const_iterator it = m_keys.find(key);
+        if (it == m_keys.end()) return posting_list();
+
+        return posting_list(m_bytes + it->second.offset, static_cast<size_type>(it->second.count));
+    }
+
+    /// Writes the posting list of every key in [kbegin, kend) to out, in the
+    /// order of the keys. The keys are searched by batched descents, see
+    /// btree_image::multi_lower_bound().
+    template <typename ForwardIterator, typename OutputIterator>
+    OutputIterator multi_equal_range(ForwardIterator kbegin, ForwardIterator kend, OutputIterator out) const
+    {
+        typename tree_image::const_iterator found[BTREE_BATCH_GROUP];
+
+        while (kbegin != kend)
+        {
+            ForwardIterator key = kbegin;
+            int n = 0;
+            for (; n < BTREE_BATCH_GROUP && kbegin != kend; ++n, ++kbegin) { }
+
+            m_keys.multi_lower_bound(key, kbegin, found);
+
+            for (int i = 0; i < n; ++i, ++key)
+            {
+                if (found[i] == m_keys.end() || m_keys.key_comp()(*key, found[i]->first))
+                    *out++ = posting_list();
+                else
+                    *out++ = posting_list(m_bytes + found[i]->second.offset, static_cast<size_type>(found[i]->second.count));
+            }
+        }
+
+        return out;
+    }
+};
+
+/** @brief Multimap variant keeping the values of each key as one compressed
+ * posting list.
+ *
+ * A B+ tree maps each distinct key once to its posting list, and the lists
+ * lie back to back in one byte array in key order. With many values per key
+ * this stores neither the key in every slot nor a slot per value, and the
+ * values of a key are read from one contiguous run of bytes. The values must
+ * be of an unsigned integral type. The multimap is built by bulk_load() and
+ * then only read, there is no insert or erase.
+ */
+template <typename _Key, typename _Data,
+          typename _Compare = std::less<_Key>,
+          typename _Traits = btree_default_map_traits<_Key, btree_posting_ref>,
+          typename _Alloc = std::allocator<std::pair<_Key, btree_posting_ref> > >
+class btree_posting_multimap
+{
+public:
+    // *** Template Parameter Types
+
+    /// First template parameter: The key type
+    typedef _Key                        key_type;
+
+    /// Second template parameter: The values of the posting lists, an
+    /// unsigned integral type
+    typedef _Data                       data_type;
+
+    /// Third template parameter: Key comparison function object
+    typedef _Compare                    key_compare;
+
+    /// Fourth template parameter: Traits object of the key tree
+    typedef _Traits                     traits;
+
+    /// Fifth template parameter: STL allocator of the key tree
+    typedef _Alloc                      allocator_type;
+
+public:
+    // *** Constructed Types
+
+    /// Typedef of our own type
+    typedef btree_posting_multimap<key_type, data_type, key_compare, traits, allocator_type> self;
+
+    /// The key/value pairs bulk_load() takes
+    typedef std::pair<key_type, data_type>      value_type;
+
+    /// Implementation type of the key tree
+    typedef stx::btree<key_type, btree_posting_ref, std::pair<key_type, btree_posting_ref>,
+                       key_compare, traits, false, allocator_type, false> btree_impl;
+
+    /// Size type used to count values
+    typedef size_t                              size_type;
+
+    /// Small structure containing statistics about the key tree
+    typedef typename btree_impl::tree_stats     tree_stats;
+
+    /// The posting list of a key
+    typedef btree_posting_list<data_type>       posting_list;
+
+    /// Read-only view searching an image written by dump_image() in place
+    typedef btree_posting_image<key_type, data_type, key_compare, traits> image_type;
+
+private:
+    // *** Members
+
+    /// The key tree
+    btree_impl                  tree;
+
+    /// The encoded values of all posting lists
+    std::vector<unsigned char>  bytes;
+
+    /// Number of values
+    size_type                   itemcount;
+
+public:
+    // *** Constructors and Destructor
+
+    /// Default constructor initializing an empty multimap with the standard
+    /// key comparison function
+    explicit inline btree_posting_multimap(const allocator_type &alloc = allocator_type())
+        : tree(alloc), itemcount(0)
+    {
+    }
+
+    /// Constructor initializing an empty multimap with a special key
+    /// comparison object
+    explicit inline btree_posting_multimap(const key_compare &kcf,
+                                           const allocator_type &alloc = allocator_type())
+        : tree(kcf, alloc), itemcount(0)
+    {
+    }
+
+    /// Frees all keys and values
+    void clear()
+    {
+        tree.clear();
+        std::vector<unsigned char>().swap(bytes);
+        itemcount = 0;
+    }
+
+    /// Constant access to the key comparison object sorting the multimap
+    inline key_compare key_comp() const
+    {
+        return tree.key_comp();
+    }
+
+public:
+    // *** Access Functions to the Item Count
+
+    /// Number of values in the multimap
+    inline size_type size() const
+    {
+        return itemcount;
+    }
+
+    /// Returns true if there is at least one value in the multimap
+    inline bool empty() const
+    {
+        return (itemcount == 0);
+    }
+
+    /// Number of distinct keys
+    inline size_type key_count() const
+    {
+        return tree.size();
+    }
+
+    /// Size of the encoded values in bytes
+    inline size_type byte_size() const
+    {
+        return bytes.size();
+    }
+
+    /// Return a const reference to the current statistics of the key tree
+    inline const tree_stats& get_stats() const
+    {
+        return tree.get_stats();
+    }
+
+public:
+    // *** Standard Access Functions Querying the Multimap
+
+    /// Number of values of the key
+    size_type count(const key_type &key) const
+    {
+        typename btree_impl::const_iterator it = tree.find(key);
+        return (it == tree.end()) ? 0 : static_cast<size_type>(it->second.count);
+    }
+
+    /// The posting list of the key, empty if the key is not present
+    posting_list equal_range(const key_type &key) const
+    {
+        typename btree_impl::const_iterator it = tree.find(key);
+        if (it == tree.end()) return posting_list();
+
+        return posting_list(&bytes[0] + it->second.offset, static_cast<size_type>(it->second.count));
+    }
+
+    /// Writes the posting list of every key in [kbegin, kend) to out, in the
+    /// order of the keys. The keys are searched by batched descents, see
+    /// btree::multi_lower_bound().
+    template <typename ForwardIterator, typename OutputIterator>
+    OutputIterator multi_equal_range(ForwardIterator kbegin, ForwardIterator kend, OutputIterator out) const
+    {
+        typename btree_impl::const_iterator found[BTREE_BATCH_GROUP];
+
+        while (kbegin != kend)
+        {
+            ForwardIterator key = kbegin;
+            int n = 0;
+            for (; n < BTREE_BATCH_GROUP && kbegin != kend; ++n, ++kbegin) { }
+
+            tree.multi_lower_bound(key, kbegin, found);
+
+            for (int i = 0; i < n; ++i, ++key)
+            {
+                if (found[i] == tree.end() || tree.key_comp()(*key, found[i]->first))
+                    *out++ = posting_list();
+                else
+                    *out++ = posting_list(&bytes[0] + found[i]->second.offset, static_cast<size_type>(found[i]->second.count));
+            }
+        }
+
+        return out;
+    }
+
+public:
+    // *** Bulk Loader
+
+    /// Bulk load a range of key/value pairs sorted by key and, among equal
+    /// keys, ascending by value. The multimap must be empty when calling this
+    /// function.
+    template <typename Iterator>
+    void bulk_load(Iterator ibegin, Iterator iend)
+    {
+        BTREE_ASSERT(empty());
+
+        std::vector< std::pair<key_type, btree_posting_ref> > refs;
+        key_compare key_less = tree.key_comp();
+
+        for (Iterator it = ibegin; it != iend; )
+        {
+            key_type key = it->first;
+
+            btree_posting_ref ref;
+            ref.offset = bytes.size();
+            ref.count = 0;
+
+            data_type last = data_type();
+            for (; it != iend && !key_less(key, it->first); ++it, ++ref.count)
+            {
+                BTREE_ASSERT(ref.count == 0 || !(it->second < last));
+
+                posting_list::encode(bytes, it->second - last);
+                last = it->second;
+            }
+
+            refs.push_back(std::make_pair(key, ref));
+            itemcount += ref.count;
+        }
+
+        // drop the spare capacity of the byte array
+        std::vector<unsigned char>(bytes).swap(bytes);
+
+        tree.bulk_load(refs.begin(), refs.end());
+    }
+
+public:
+    // *** Pointer-free Image
+
+    /// Dump the multimap onto an ostream as a pointer-free image, which can be
+    /// searched in place by an image_type attached to it. The image must start
+    /// at an offset aligned to the key tree's image alignment.
+    void dump_image(std::ostream &os) const
+    {
+        typedef typename btree_impl::image_layout layout;
+
+        btree_posting_header header;
+        header.fill(sizeof(data_type));
+        header.itemcount = itemcount;
+        header.bytes = bytes.size();
+
+        os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        for (size_t pad = layout::align(sizeof(header)) - sizeof(header); pad > 0; --pad)
+            os.put(0);
+
+        tree.dump_image(os);
+
+        if (!bytes.empty())
+            os.write(reinterpret_cast<const char*>(&bytes[0]), bytes.size());
+    }
+};
+
+} // namespace stx
+
+#endif // _STX_BTREE_POSTING_H_
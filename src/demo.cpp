@@ -33,7 +33,7 @@ bool get(dsa::Database& database)
 	#endif
 
 	unsigned int u, a, q;
-	unsigned char p, d;
+	unsigned short p, d;
 	std::cin >> u >> a >> q >> p >> d;
 	#ifdef DEBUG
 	std::cout << "Parameters: (u, a, q, p, d) = ("
@@ -0,0 +1,247 @@
+#include <stdexcept>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <random>
+#include <algorithm>
+#include <vector>
+
+// Generates a synthetic data file in the format of the KDD Cup 2012 track 2
+// training set, and a recorded mix of commands for it in the input format of
+// demo, to be fed to demo or kdd_replay.
+//
+// Usage: kdd_gen <data file> <command file> [options]
+//	--rows N		lines of the data file (1000000)
+//	--users N		distinct users (100000)
+//	--ads N			distinct ads (20000)
+//	--skew S		Zipf exponent of the users and ads, 0 is uniform (1.0)
+//	--commands N	commands of the command file (10000)
+//	--mix G,C,I,P	weights of get, clicked, impressed and profit (70,10,10,10)
+//	--seed N		seed of the generator (2012)
+
+#define NEWLINE 			'\n'
+#define DELIM 				'\t'
+
+struct Options
+{
+	size_t rows = 1000000;
+	unsigned int users = 100000;
+	unsigned int ads = 20000;
+	double skew = 1.0;
+	size_t commands = 10000;
+	std::vector<double> mix = { 70, 10, 10, 10 };
+	unsigned int seed = 2012;
+};
+
+// Draws ids from 1 to n, id k with a weight of 1/k^s
+class Zipf
+{
+private:
+	std::vector<double> cdf;
+	std::uniform_real_distribution<double> weight_dist;
+
+public:
+	Zipf(unsigned int n, double s)
+		: cdf(std::max(n, 1u))
+	{
+		double sum = 0.0;
+		for(size_t k = 0; k < cdf.size(); k++)
+			cdf[k] = (sum += 1.0 / std::pow((double)(k + 1), s));
+		weight_dist = std::uniform_real_distribution<double>(0.0, sum);
+	}
+
+	template <typename Rng>
+	unsigned int operator()(Rng& rng)
+	{
+		size_t k = std::lower_bound(cdf.begin(), cdf.end(), weight_dist(rng)) - cdf.begin();
+		return (unsigned int)std::min(k, cdf.size() - 1) + 1;
+	}
+};
+
+// Fields of a line, in the order of the file
+struct Line
+{
+	unsigned int click;
+	unsigned int impression;
+	unsigned long long display_url;
+	unsigned int ad_id;
+	unsigned int advertiser_id;
+	unsigned short depth;
+	unsigned short position;
+	unsigned int query_id;
+	unsigned int keyword_id;
+	unsigned int title_id;
+	unsigned int description_id;
+	unsigned int user_id;
+};
+
+// Properties are fixed by the ad with a few variants, like the creatives of
+// a campaign.
+template <typename Rng>
+Line generate_line(Rng& rng, Zipf& users, Zipf& ads)
+{
+	std::uniform_int_distribution<unsigned int> variant_dist(0, 3);
+	std::uniform_int_distribution<unsigned int> query_dist(1, 1000000);
+	std::uniform_int_distribution<unsigned int> depth_dist(1, 3);
+	std::geometric_distribution<unsigned int> impression_dist(0.5);
+	std::uniform_real_distribution<double> ratio_dist(0.0, 1.0);
+
+	Line line;
+	line.ad_id = ads(rng);
+	line.user_id = users(rng);
+	unsigned int variant = variant_dist(rng);
+	line.advertiser_id = line.ad_id % 9973 + 1;
+	line.display_url = (unsigned long long)line.ad_id * 2654435761ULL + variant;
+	line.keyword_id = line.ad_id * 4 + variant;
+	line.title_id = line.ad_id * 4 + (variant + 1) % 4;
+	line.description_id = line.ad_id * 4 + (variant + 2) % 4;
+	line.query_id = query_dist(rng);
+	line.depth = (unsigned short)depth_dist(rng);
+	line.position = (unsigned short)std::uniform_int_distribution<unsigned int>(1, line.depth)(rng);
+	line.impression = impression_dist(rng) + 1;
+	// About one line in twenty has clicks
+	line.click = (ratio_dist(rng) < 0.05) ?
+				 std::uniform_int_distribution<unsigned int>(1, line.impression)(rng) : 0;
+	return line;
+}
+
+void write_line(std::ostream& os, const Line& line)
+{
+	os << line.click << DELIM
+	   << line.impression << DELIM
+	   << line.display_url << DELIM
+	   << line.ad_id << DELIM
+	   << line.advertiser_id << DELIM
+	   << line.depth << DELIM
+	   << line.position << DELIM
+	   << line.query_id << DELIM
+	   << line.keyword_id << DELIM
+	   << line.title_id << DELIM
+	   << line.description_id << DELIM
+	   << line.user_id << NEWLINE;
+}
+
+Options parse_options(int argc, char* argv[])
+{
+	Options options;
+	for(int idx = 3; idx < argc; idx++)
+	{
+		if(idx + 1 >= argc)
+			throw std::runtime_error("parse_options(): Option without a value.");
+
+		std::string name = argv[idx];
+		std::string value = argv[++idx];
+		if(name == "--rows")
+			options.rows = std::strtoull(value.c_str(), NULL, 10);
+		else if(name == "--users")
+			options.users = std::strtoul(value.c_str(), NULL, 10);
+		else if(name == "--ads")
+			options.ads = std::strtoul(value.c_str(), NULL, 10);
+		else if(name == "--skew")
+			options.skew = std::strtod(value.c_str(), NULL);
+		else if(name == "--commands")
+			options.commands = std::strtoull(value.c_str(), NULL, 10);
+		else if(name == "--seed")
+			options.seed = std::strtoul(value.c_str(), NULL, 10);
+		else if(name == "--mix")
+		{
+			std::istringstream is(value);
+			std::string weight;
+			options.mix.clear();
+			while(std::getline(is, weight, ','))
+				options.mix.push_back(std::strtod(weight.c_str(), NULL));
+			if(options.mix.size() != 4)
+				throw std::runtime_error("parse_options(): Mix needs four weights.");
+		}
+		else
+			throw std::runtime_error("parse_options(): Unknown option " + name + ".");
+	}
+
+	if(options.rows == 0 || options.users == 0 || options.ads == 0)
+		throw std::runtime_error("parse_options(): Rows, users and ads can't be zero.");
+	return options;
+}
+
+int main(int argc, char* argv[])
+{
+	try
+	{
+		if(argc < 3)
+			throw std::runtime_error("main(): Usage: kdd_gen <data file> <command file> [options]");
+		Options options = parse_options(argc, argv);
+
+		std::mt19937_64 rng(options.seed);
+		Zipf users(options.users, options.skew), ads(options.ads, options.skew);
+
+		// Lines the get commands are drawn from, a uniform sample of the file
+		size_t num_samples = std::max<size_t>(std::min(options.rows, options.commands), 1);
+		std::vector<Line> samples;
+		samples.reserve(num_samples);
+
+		std::ofstream data(argv[1], std::ofstream::out | std::ofstream::trunc);
+		if(!data.is_open())
+			throw std::runtime_error("main(): Fail to open the data file.");
+		for(size_t row = 0; row < options.rows; row++)
+		{
+			Line line = generate_line(rng, users, ads);
+			write_line(data, line);
+
+			if(samples.size() < num_samples)
+				samples.push_back(line);
+			else
+			{
+				size_t victim = std::uniform_int_distribution<size_t>(0, row)(rng);
+				if(victim < samples.size())
+					samples[victim] = line;
+			}
+		}
+		if(!data.good())
+			throw std::runtime_error("main(): Fail to write the data file.");
+
+		std::ofstream commands(argv[2], std::ofstream::out | std::ofstream::trunc);
+		if(!commands.is_open())
+			throw std::runtime_error("main(): Fail to open the command file.");
+
+		// Users and ads of the commands follow the skew of the data
+		std::discrete_distribution<int> mix_dist(options.mix.begin(), options.mix.end());
+		std::uniform_int_distribution<size_t> sample_dist(0, samples.size() - 1);
+		const double thresholds[] = { 0.0, 0.1, 0.5, 1.0 };
+		std::uniform_int_distribution<int> threshold_dist(0, 3);
+		for(size_t idx = 0; idx < options.commands; idx++)
+		{
+			switch(mix_dist(rng))
+			{
+				case 0:
+				{
+					const Line& line = samples[sample_dist(rng)];
+					commands << "get " << line.user_id << ' ' << line.ad_id << ' ' << line.query_id << ' '
+							 << line.position << ' ' << line.depth << NEWLINE;
+					break;
+				}
+				case 1:
+					commands << "clicked " << users(rng) << NEWLINE;
+					break;
+				case 2:
+					commands << "impressed " << users(rng) << ' ' << users(rng) << NEWLINE;
+					break;
+				default:
+					commands << "profit " << ads(rng) << ' ' << thresholds[threshold_dist(rng)] << NEWLINE;
+					break;
+			}
+		}
+		commands << "quit" << NEWLINE;
+		if(!commands.good())
+			throw std::runtime_error("main(): Fail to write the command file.");
+	}
+	catch(const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,209 @@
+#include <stdexcept>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string>
+#include <cstdlib>
+#include <chrono>
+#include <algorithm>
+#include <vector>
+
+#include "ad_database.h"
+
+// Replays a file of commands in the input format of demo against dsa::KDD,
+// and reports the throughput and the latency percentiles of every command
+// type. The commands can come from kdd_gen or from a recorded session.
+//
+// Usage: kdd_replay <data file> <command file> [options]
+//	--repeat N		passes over the commands (3)
+//	--batch			run every pass through KDD::batch() instead
+
+typedef dsa::KDD::Query Query;
+
+const char* type_names[] = { "get", "clicked", "impressed", "profit" };
+
+// Latencies of a command type, in microseconds
+typedef std::vector<double> Latencies;
+
+// Read commands up to the end of the file, quit or an unknown command
+std::vector<Query> read_commands(const std::string& path)
+{
+	std::ifstream is(path);
+	if(!is.is_open())
+		throw std::runtime_error("read_commands(): Fail to open file.");
+
+	std::vector<Query> queries;
+	std::string instruction;
+	while(is >> instruction)
+	{
+		Query query = Query();
+		if(instruction == "get")
+		{
+			query.type = Query::GET;
+			is >> query.user_id >> query.ad_id >> query.query_id >> query.position >> query.depth;
+		}
+		else if(instruction == "clicked")
+		{
+			query.type = Query::CLICKED;
+			is >> query.user_id;
+		}
+		else if(instruction == "impressed")
+		{
+			query.type = Query::IMPRESSED;
+			is >> query.user_id >> query.user_id_2;
+		}
+		else if(instruction == "profit")
+		{
+			query.type = Query::PROFIT;
+			is >> query.ad_id >> query.ctr_threshold;
+		}
+		else
+			break;
+
+		if(!is)
+			throw std::runtime_error("read_commands(): Malformed " + instruction + " command.");
+		queries.push_back(query);
+	}
+
+	return queries;
+}
+
+// Execute the query, returns the size of its result
+size_t execute(dsa::Database& database, const Query& query)
+{
+	switch(query.type)
+	{
+		case Query::GET:
+			return dsa::KDD::get(database, query.user_id, query.ad_id, query.query_id,
+								 query.position, query.depth).second;
+		case Query::CLICKED:
+			return dsa::KDD::clicked(database, query.user_id).size();
+		case Query::IMPRESSED:
+			return dsa::KDD::impressed(database, query.user_id, query.user_id_2).size();
+		default:
+			return dsa::KDD::profit(database, query.ad_id, query.ctr_threshold).size();
+	}
+}
+
+double percentile(const Latencies& sorted, double ratio)
+{
+	if(sorted.empty())
+		return 0.0;
+	size_t idx = (size_t)(ratio * (sorted.size() - 1) + 0.5);
+	return sorted[idx];
+}
+
+void report(const std::string& name, Latencies latencies)
+{
+	std::sort(latencies.begin(), latencies.end());
+	double total = 0.0;
+	for(const auto& elem : latencies)
+		total += elem;
+
+	std::cout << std::left << std::setw(12) << name << std::right
+			  << std::setw(10) << latencies.size() << std::fixed << std::setprecision(1)
+			  << std::setw(12) << ((total > 0.0) ? latencies.size() / total * 1e6 : 0.0)
+			  << std::setw(12) << percentile(latencies, 0.50)
+			  << std::setw(12) << percentile(latencies, 0.90)
+			  << std::setw(12) << percentile(latencies, 0.99)
+			  << std::setw(12) << (latencies.empty() ? 0.0 : latencies.back())
+			  << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+	try
+	{
+		if(argc < 3)
+			throw std::runtime_error("main(): Usage: kdd_replay <data file> <command file> [options]");
+
+		int repeat = 3;
+		bool batch = false;
+		for(int idx = 3; idx < argc; idx++)
+		{
+			std::string name = argv[idx];
+			if(name == "--batch")
+				batch = true;
+			else if(name == "--repeat" && idx + 1 < argc)
+				repeat = std::atoi(argv[++idx]);
+			else
+				throw std::runtime_error("main(): Unknown option " + name + ".");
+		}
+		if(repeat < 1)
+			throw std::runtime_error("main(): At least one pass is needed.");
+
+		auto start = std::chrono::steady_clock::now();
+		dsa::Database database(argv[1]);
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		std::cout << "database, elapsed time: " << elapsed.count() << " s" << std::endl;
+
+		std::vector<Query> queries = read_commands(argv[2]);
+		std::cout << queries.size() << " commands, " << repeat << " passes"
+				  << (batch ? " through batch()" : "") << std::endl;
+
+		std::cout << std::left << std::setw(12) << "command" << std::right
+				  << std::setw(10) << "count"
+				  << std::setw(12) << "per second"
+				  << std::setw(12) << "p50"
+				  << std::setw(12) << "p90"
+				  << std::setw(12) << "p99"
+				  << std::setw(12) << "max"
+				  << "  (us)" << std::endl;
+
+		// Keeps the results from being optimized away
+		size_t checksum = 0;
+		if(!batch)
+		{
+			std::vector<Latencies> latencies(4);
+			Latencies all;
+			for(int pass = 0; pass < repeat; pass++)
+			{
+				for(const auto& query : queries)
+				{
+					auto query_start = std::chrono::steady_clock::now();
+					checksum += execute(database, query);
+					std::chrono::duration<double, std::micro> query_elapsed = std::chrono::steady_clock::now() - query_start;
+					latencies[query.type].push_back(query_elapsed.count());
+					all.push_back(query_elapsed.count());
+				}
+			}
+
+			for(int type = Query::GET; type <= Query::PROFIT; type++)
+				report(type_names[type], latencies[type]);
+			report("all", all);
+		}
+		else
+		{
+			// Only whole passes can be timed, the percentiles are of the
+			// times of the passes.
+			Latencies passes;
+			for(int pass = 0; pass < repeat; pass++)
+			{
+				auto pass_start = std::chrono::steady_clock::now();
+				std::vector<dsa::KDD::Result> results = dsa::KDD::batch(database, queries);
+				std::chrono::duration<double, std::micro> pass_elapsed = std::chrono::steady_clock::now() - pass_start;
+				passes.push_back(pass_elapsed.count());
+				checksum += results.size();
+			}
+
+			std::sort(passes.begin(), passes.end());
+			std::cout << std::left << std::setw(12) << "batch" << std::right
+					  << std::setw(10) << queries.size() * passes.size() << std::fixed << std::setprecision(1)
+					  << std::setw(12) << queries.size() / percentile(passes, 0.50) * 1e6
+					  << std::setw(12) << percentile(passes, 0.50)
+					  << std::setw(12) << percentile(passes, 0.90)
+					  << std::setw(12) << percentile(passes, 0.99)
+					  << std::setw(12) << passes.back()
+					  << std::endl;
+		}
+
+		std::cout << "checksum " << checksum << std::endl;
+	}
+	catch(const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}